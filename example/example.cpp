@@ -10,19 +10,44 @@ int main(int argc, const char** argv)
     // Enable the multi-line mode
     linenoise::SetMultiLine(true);
 
+    // Make Up/Down only walk the history entries starting with the typed text
+    linenoise::SetHistoryPrefixSearch(true);
+
+    // Suggest the newest matching history entry as grey text
+    linenoise::SetHistorySuggestions(true);
+
     // Set max length of the history
     linenoise::SetHistoryMaxLen(4);
 
-    // Setup completion words every time when a user types
-    linenoise::SetCompletionCallback([](const char* editBuffer, std::vector<std::string>& completions) {
-        if (editBuffer[0] == 'h') {
+    // Setup completion words, looked up by the word under the cursor
+    linenoise::CompletionTrie words;
 #ifdef _WIN32
-            completions.push_back("hello こんにちは");
-            completions.push_back("hello こんにちは there");
+    words.Add("hello こんにちは");
+    words.Add("hello こんにちは there");
 #else
-            completions.push_back("hello");
-            completions.push_back("hello there");
+    words.Add("hello");
+    words.Add("hello there");
 #endif
+    words.Add("help");
+    words.Add("history");
+    linenoise::SetCompletionRangeCallback(words.Callback());
+
+    // Show a hint at the right of what a user types
+    linenoise::SetHintsCallback([](const char* editBuffer, int& color, int& bold) {
+        if (!strcmp(editBuffer, "hello")) {
+            color = 35;
+            bold = 0;
+            return std::string(" World");
+        }
+        return std::string();
+    });
+
+    // Color the digits, restyling only the range edited since the last call
+    linenoise::SetHighlightCallback([](const char* editBuffer, int /* len */, int start, int end, std::vector<linenoise::HighlightSpan>& spans) {
+        for (int i = start; i < end; i++) {
+            if (isdigit((unsigned char)editBuffer[i])) {
+                spans.push_back({i, 1, 33, 0});
+            }
         }
     });
 
@@ -0,0 +1,42 @@
+#include <iostream>
+#include <fstream>
+#include "../linenoise.hpp"
+
+using namespace std;
+
+// Build a completion dictionary from a list of words, one per line:
+//
+//   mkdict words.dict < words.txt
+//   mkdict words.dict words.txt
+int main(int argc, const char** argv)
+{
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " <dictionary> [word list]" << endl;
+        return 1;
+    }
+
+    ifstream file;
+    if (argc > 2) {
+        file.open(argv[2]);
+        if (!file) {
+            cerr << argv[2] << ": can't open" << endl;
+            return 1;
+        }
+    }
+    istream& in = (argc > 2) ? file : cin;
+
+    vector<string> words;
+    string word;
+    while (getline(in, word)) {
+        if (!word.empty()) {
+            words.push_back(word);
+        }
+    }
+
+    if (!linenoise::BuildDictionary(words, argv[1])) {
+        cerr << argv[1] << ": can't write" << endl;
+        return 1;
+    }
+
+    return 0;
+}
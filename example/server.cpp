@@ -0,0 +1,271 @@
+#include <iostream>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "../linenoise.hpp"
+
+using namespace std;
+
+// Line editing for many clients on one thread.
+//
+//   server /tmp/admin.sock
+//       serves an admin console on a Unix socket; connect with
+//       socat -,raw,echo=0 UNIX-CONNECT:/tmp/admin.sock
+//
+//   server --load 10000 [rounds]
+//       measures the keystroke latency of that many sessions over socket
+//       pairs, typed by a second process
+
+static int serve(const char* path)
+{
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (lfd == -1 || ::bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(lfd, 128) == -1) {
+        perror(path);
+        return 1;
+    }
+
+    linenoise::CompletionTrie commands;
+    commands.Add("help");
+    commands.Add("history");
+    commands.Add("quit");
+    commands.Add("shutdown");
+    commands.Add("who");
+
+    linenoise::SessionServer server;
+    vector<int> fds; // Socket of each session
+    bool running = true;
+
+    auto say = [&](int session, const string& text) {
+        server.Write(session, text);
+    };
+
+    server.SetLineCallback([&](int session, const string& line) {
+        server.GetEditor(session).AddHistory(line.c_str());
+        if (line == "quit") {
+            int fd = fds[session];
+            server.Close(session);
+            close(fd);
+        } else if (line == "shutdown") {
+            running = false;
+        } else if (line == "who") {
+            say(session, to_string(server.Size()) + " sessions\r\n");
+        } else if (line == "history") {
+            for (const auto& h: server.GetEditor(session).GetHistory()) say(session, h + "\r\n");
+        } else if (line == "help") {
+            say(session, "help history quit shutdown who\r\n");
+        } else if (!line.empty()) {
+            say(session, "echo: '" + line + "'\r\n");
+        }
+    });
+    server.SetCloseCallback([&](int session) {
+        close(fds[session]);
+    });
+
+    cout << "listening on " << path << endl;
+    while (running) {
+        struct pollfd p[2] = {{lfd, POLLIN, 0}, {server.Fd(), POLLIN, 0}};
+        if (poll(p, 2, server.Timeout()) == -1 && errno != EINTR) break;
+        if (p[0].revents & POLLIN) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            int session = fd == -1 ? -1 : server.Add(fd, fd, "admin> ", 80, 24);
+            if (session == -1) {
+                if (fd != -1) close(fd);
+            } else {
+                if (fds.size() <= (size_t)session) fds.resize(session + 1);
+                fds[session] = fd;
+                server.GetEditor(session).SetCompletionRangeCallback(commands.Callback());
+                server.GetEditor(session).SetHistorySuggestions(true);
+            }
+        }
+        if (p[1].revents & POLLIN || server.Timeout() == 0) server.Poll(0);
+    }
+    close(lfd);
+    unlink(path);
+    return 0;
+}
+
+static double percentile(vector<double>& v, double p)
+{
+    if (v.empty()) return 0;
+    size_t i = min(v.size() - 1, (size_t)(p * v.size()));
+    nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+static void report(const char* what, vector<double>& v, double seconds)
+{
+    double p50 = percentile(v, 0.5), p99 = percentile(v, 0.99), max = percentile(v, 1);
+    printf("  %-13s %7zu keys  p50 %8.1f us  p99 %8.1f us  max %8.1f us  %9.0f keys/s\n",
+           what, v.size(), p50, p99, max, v.size() / seconds);
+}
+
+// Type into every session of 'fds' and time the first byte of each echo
+static void type(const vector<int>& fds, int rounds)
+{
+    int ep = epoll_create1(0);
+    for (size_t i = 0; i < fds.size(); i++) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+    vector<struct epoll_event> events(1024);
+    char buf[4096];
+    typedef chrono::steady_clock clock;
+
+    // Read whatever the server still writes, e.g. the prompts
+    auto drain = [&](int ms) {
+        while (true) {
+            int n = epoll_wait(ep, events.data(), events.size(), ms);
+            if (n <= 0) return;
+            for (int i = 0; i < n; i++) {
+                if (read(fds[events[i].data.u64], buf, sizeof(buf)) == -1) {}
+            }
+        }
+    };
+    auto key = [&](int round) { return round % 8 == 7 ? '\r' : (char)('a' + round % 26); };
+
+    drain(200);
+
+    // One client types while the others are idle
+    vector<double> single;
+    auto start = clock::now();
+    for (int r = 0; r < rounds * 8; r++) {
+        int i = (r * 7919) % fds.size();
+        char c = key(r);
+        auto sent = clock::now();
+        if (write(fds[i], &c, 1) != 1) return;
+        while (true) {
+            int n = epoll_wait(ep, events.data(), events.size(), 1000);
+            if (n <= 0) return;
+            bool echoed = false;
+            for (int j = 0; j < n; j++) {
+                if (read(fds[events[j].data.u64], buf, sizeof(buf)) == -1) {}
+                if (events[j].data.u64 == (uint64_t)i) echoed = true;
+            }
+            if (echoed) break;
+        }
+        single.push_back(chrono::duration<double, micro>(clock::now() - sent).count());
+        drain(c == '\r' ? 2 : 0);
+    }
+    report("one typing", single, chrono::duration<double>(clock::now() - start).count());
+
+    // Every client types a key at once
+    vector<double> all;
+    vector<clock::time_point> sent(fds.size());
+    vector<char> echoed(fds.size());
+    start = clock::now();
+    for (int r = 0; r < rounds; r++) {
+        char c = key(r);
+        for (size_t i = 0; i < fds.size(); i++) {
+            sent[i] = clock::now();
+            echoed[i] = 0;
+            if (write(fds[i], &c, 1) != 1) return;
+        }
+        size_t left = fds.size();
+        while (left > 0) {
+            int n = epoll_wait(ep, events.data(), events.size(), 1000);
+            if (n <= 0) return;
+            auto now = clock::now();
+            for (int j = 0; j < n; j++) {
+                size_t i = events[j].data.u64;
+                if (read(fds[i], buf, sizeof(buf)) == -1) {}
+                if (echoed[i]) continue;
+                echoed[i] = 1;
+                left--;
+                all.push_back(chrono::duration<double, micro>(now - sent[i]).count());
+            }
+        }
+        drain(c == '\r' ? 20 : 0);
+    }
+    report("all typing", all, chrono::duration<double>(clock::now() - start).count());
+    close(ep);
+}
+
+static int load(int sessions, int rounds)
+{
+    // One descriptor per session in each process, plus a few
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if ((rlim_t)sessions + 64 > rl.rlim_cur) {
+        cerr << "at most " << rl.rlim_cur - 64 << " sessions with the descriptor limit" << endl;
+        return 1;
+    }
+
+    // The typing process connects to an abstract socket, private to this run
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "linenoise-load-%d", (int)getpid());
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd == -1 || ::bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(lfd, 1024) == -1) {
+        perror("listen");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The typist writes to its sockets directly
+        signal(SIGPIPE, SIG_IGN);
+        close(lfd);
+        vector<int> fds;
+        for (int i = 0; i < sessions; i++) {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+                perror("connect");
+                _exit(1);
+            }
+            fds.push_back(fd);
+        }
+        type(fds, rounds);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    linenoise::SessionServer server;
+    vector<int> fds(sessions);
+    server.SetLineCallback([&](int session, const string& line) {
+        server.GetEditor(session).AddHistory(line.c_str());
+    });
+    server.SetCloseCallback([&](int session) {
+        close(fds[session]);
+    });
+    for (int i = 0; i < sessions; i++) {
+        int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        // Sessions are numbered in order, as none is closed yet
+        if (fd == -1 || server.Add(fd, fd, "> ", 80, 24) == -1) {
+            perror("session");
+            kill(pid, SIGTERM);
+            return 1;
+        }
+        fds[i] = fd;
+    }
+    close(lfd);
+    printf("%d sessions\n", sessions);
+    fflush(stdout);
+    while (server.Size() > 0 && server.Poll(-1) != -1) {}
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+int main(int argc, const char** argv)
+{
+    if (argc >= 3 && !strcmp(argv[1], "--load")) {
+        return load(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 20);
+    }
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " <socket path>" << endl;
+        cerr << "       " << argv[0] << " --load <sessions> [rounds]" << endl;
+        return 1;
+    }
+    return serve(argv[1]);
+}
@@ -0,0 +1,635 @@
+#include <iostream>
+#include <thread>
+#include <sys/socket.h>
+#include "../linenoise.hpp"
+
+using namespace std;
+using namespace linenoise;
+
+// Checks of what works without a terminal: the parts used on their own,
+// and editors fed keys over a socket pair as a terminal of known size.
+//
+//   test_linenoise
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+// An editor on a socket pair, typed on from the other end.
+struct TestTerminal {
+    TestTerminal()
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) fds[0] = fds[1] = -1;
+        editor.reset(new Editor(fds[0], fds[0]));
+        editor->SetTerminalSize(80, 24);
+    }
+
+    ~TestTerminal()
+    {
+        editor.reset();
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    // Edit a line typing 'keys', which must end it; returns the line, or
+    // "<eof>" for ctrl-c or ctrl-d and "<stuck>" if it never ends.
+    string type(const string& keys, const char* prompt = "> ")
+    {
+        string line;
+        if (!editor->EditStart(prompt)) return "<stuck>";
+        if (write(fds[1], keys.data(), keys.size()) != static_cast<ssize_t>(keys.size())) return "<stuck>";
+        EditStatus status;
+        while ((status = editor->EditFeed(line)) == EDIT_MORE) {
+            drain();
+            vector<int> wait;
+            editor->EditPollFds(wait);
+            vector<struct pollfd> pfds;
+            for (int fd: wait) pfds.push_back({fd, POLLIN, 0});
+            int timeout = editor->EditTimeout();
+            if (poll(pfds.data(), pfds.size(), timeout < 0 ? 1000 : timeout) == 0 && timeout < 0) {
+                editor->EditStop();
+                return "<stuck>";
+            }
+        }
+        editor->EditStop();
+        drain();
+        return status == EDIT_LINE ? line : "<eof>";
+    }
+
+    // Throw away what the editor wrote.
+    void drain()
+    {
+        char buf[4096];
+        while (recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+    }
+
+    int fds[2];
+    unique_ptr<Editor> editor;
+};
+
+// Decode 's' as one read; returns the bytes taken and sets *key.
+static int decode(const string& s, bool complete, int* key)
+{
+    *key = -1;
+    return linenoiseDecodeKey(s.data(), static_cast<int>(s.size()), complete, key);
+}
+
+static void testDecodeKey()
+{
+    int key;
+    check(decode("a", false, &key) == 1 && key == 'a', "plain key");
+    check(decode("\xc3\xa9x", false, &key) == 2 && key == 0xE9, "utf-8 key");
+    check(decode("\xe2\x82", false, &key) == 0, "partial utf-8 waits");
+    check(decode("\x1b", false, &key) == 0, "lone escape waits");
+    check(decode("\x1b", true, &key) == 1 && key == ESC, "lone escape after timeout");
+    check(decode("\x1b[A", false, &key) == 3 && key == ARROW_UP, "csi arrow");
+    check(decode("\x1bOB", false, &key) == 3 && key == ARROW_DOWN, "ss3 arrow");
+    check(decode("\x1b[1;5C", false, &key) == 6 && key == (ARROW_RIGHT | MOD_CTRL), "ctrl arrow");
+    check(decode("\x1b[3~", false, &key) == 4 && key == DEL_KEY, "delete");
+    check(decode("\x1b[1", false, &key) == 0, "partial csi waits");
+    check(decode("\x1b" "b", false, &key) == 2 && key == ('b' | MOD_ALT), "alt key");
+    check(decode("\x1b[?62;4cq", false, &key) == 8 && key == UNKNOWN_KEY, "terminal report skipped");
+    check(decode("\x1b[[A", false, &key) == 4 && key == F1_KEY, "linux console F1");
+}
+
+static void testKeymap()
+{
+    check(linenoiseParseKey("F5") == F5_KEY, "F5 parsed");
+    check(linenoiseParseKey("C-F12") == (F12_KEY | MOD_CTRL), "C-F12 parsed");
+    check(linenoiseParseKey("S-F1") == (F1_KEY | MOD_SHIFT), "S-F1 parsed");
+    check(linenoiseParseKey("F13") == -1 && linenoiseParseKey("F0") == -1 && linenoiseParseKey("F1x") == -1,
+          "bad function keys refused");
+    check(linenoiseParseKey("C-a") == CTRL_A, "C-a parsed");
+    check(linenoiseParseKey("M-Left") == (ARROW_LEFT | MOD_ALT), "M-Left parsed");
+    check(linenoiseParseKey("Nope") == -1, "unknown name refused");
+
+    TestTerminal t;
+    t.editor->AddKeyAction("my-action", [](string& line, size_t& pos) {
+        line += "!";
+        pos = line.size();
+        return false;
+    });
+    t.editor->AddKeyAction("wrap", [](string& line, size_t& pos) {
+        line = "[" + line + "]";
+        pos = line.size();
+        return true;
+    });
+    check(t.editor->LoadKeymap("F5: my-action\n"
+                               "C-F12: wrap   # accepts the line\n"
+                               "\n"
+                               "C-b: backward-word\n"), "keymap loaded");
+    check(t.type("hi\x1b[15~\x1b[15~\r") == "hi!!", "F5 bound");
+    check(t.type("ab cd\x1b[24;5~") == "[ab cd]", "C-F12 bound");
+    check(t.type("ab cd\x02X\r") == "ab Xcd", "C-b bound");
+    check(!t.editor->LoadKeymap("F5: no-such-action\n"), "unknown action refused");
+    check(!t.editor->LoadKeymap("F5 my-action\n"), "line without colon refused");
+}
+
+static void testEditFeed()
+{
+    // An editor reading a pipe and writing to another, fed a few bytes at
+    // a time: keys split across writes wait for the rest without blocking.
+    int in[2], out[2];
+    check(pipe(in) == 0 && pipe(out) == 0, "edit pipes");
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    auto drain = [&]() {
+        string written;
+        char buf[4096];
+        ssize_t n;
+        while ((n = read(out[0], buf, sizeof(buf))) > 0) written.append(buf, n);
+        return written;
+    };
+    Editor editor(in[0], out[1]);
+    editor.SetTerminalSize(80, 24);
+    string line;
+
+    check(editor.EditFeed(line) == EDIT_EOF, "feed before start");
+    check(editor.EditStart("> "), "edit started on a pipe");
+    check(drain() == "> ", "prompt written");
+    check(editor.EditFeed(line) == EDIT_MORE, "feed without input does not block");
+    for (const char* part: {"he", "\xc3", "\xa9llo", "\x1b", "[D", "X"}) {
+        check(write(in[1], part, strlen(part)) == static_cast<ssize_t>(strlen(part)), "edit input written");
+        check(editor.EditFeed(line) == EDIT_MORE, "partial keys wait");
+    }
+    check(drain().find("he\xc3\xa9llXo") != string::npos, "line drawn as typed");
+
+    vector<int> fds;
+    editor.EditPollFds(fds);
+    check(!fds.empty() && fds[0] == in[0], "input polled");
+    editor.EditHide();
+    check(drain() == "\r\x1b[0K", "line hidden");
+    editor.EditShow();
+    check(drain().find("> he\xc3\xa9llXo") != string::npos, "line shown again");
+
+    check(write(in[1], "\r", 1) == 1, "enter written");
+    check(editor.EditFeed(line) == EDIT_LINE && line == "he\xc3\xa9llXo", "line ready");
+    check(editor.EditFeed(line) == EDIT_EOF, "feed after the line");
+    editor.EditStop();
+
+    check(editor.EditStart("> ") && write(in[1], "\x04", 1) == 1, "ctrl-d written");
+    check(editor.EditFeed(line) == EDIT_EOF, "ctrl-d on an empty line");
+    editor.EditStop();
+
+    check(editor.EditStart("> ") && write(in[1], "ab", 2) == 2, "input before hang-up");
+    close(in[1]);
+    check(editor.EditFeed(line) == EDIT_LINE && line == "ab", "hang-up ends the line");
+    editor.EditStop();
+    check(editor.EditStart("> ") && editor.EditFeed(line) == EDIT_EOF, "hang-up on an empty line");
+    editor.EditStop();
+    drain();
+    close(in[0]);
+    close(out[0]);
+    close(out[1]);
+}
+
+static void testSuggestions()
+{
+    TestTerminal t;
+    Editor& ed = *t.editor;
+    for (const char* line: {"apple pie", "banana", "apricot"}) ed.AddHistory(line);
+    ed.SetHistorySuggestions(true);
+    const string right = "\x1b[C";
+    check(t.type("a" + right + "\r") == "apricot", "suggestion of the newest match");
+    check(t.type("app" + right + "\r") == "apple pie", "suggestion narrowed");
+    check(t.type("c" + right + "\r") == "c", "no suggestion without match");
+    ed.AddHistory("cherry");
+    check(t.type("c" + right + "\r") == "cherry", "suggestion of an entry added since");
+}
+
+static void testHistory()
+{
+    TestTerminal t;
+    Editor& ed = *t.editor;
+    for (const char* line: {"git status", "ls", "git commit", "git status", "make"}) ed.AddHistory(line);
+    check(!ed.AddHistory("make"), "repeated line not added");
+
+    const string up = "\x1b[A", down = "\x1b[B", right = "\x1b[C";
+    check(t.type(up + up + "\r") == "git status", "history walk");
+    ed.SetHistoryPrefixSearch(true);
+    check(t.type("git" + up + "\r") == "git status", "prefix search newest first");
+    check(t.type("git" + up + up + "\r") == "git commit", "prefix search older");
+    check(t.type("git" + up + up + up + "\r") == "git commit", "prefix search skips repeated lines");
+    check(t.type("git" + up + up + down + "\r") == "git status", "prefix search newer");
+    check(t.type("git" + up + down + "\r") == "git", "prefix search back to the line edited");
+    check(t.type("nope" + up + "\r") == "nope", "prefix search without match");
+
+    ed.SetHistorySuggestions(true);
+    check(t.type("gi" + right + "\r") == "git status", "suggestion along prefix search");
+    check(t.type("git c" + right + "\r") == "git commit", "suggestion narrowed");
+
+    // Shrinking drops the oldest entries, and the index follows. The line
+    // edited takes a place too, pushing out the oldest while it lasts.
+    check(ed.SetHistoryMaxLen(3), "history shrunk");
+    check(ed.GetHistory() == vector<string>({"git commit", "git status", "make"}), "oldest entries dropped");
+    check(t.type("git" + up + up + "\r") == "git status", "prefix search after shrinking");
+    check(t.type("l" + up + "\r") == "l", "dropped entry not found");
+    ed.AddHistory("ls -l");
+    check(ed.GetHistory() == vector<string>({"git status", "make", "ls -l"}), "history kept at its length");
+    check(t.type("l" + right + "\r") == "ls -l", "suggestion from a new entry");
+}
+
+// The words 'fn' is called with by ForEach(prefix).
+template <class Source>
+static vector<string> wordsFrom(const Source& source, const char* prefix)
+{
+    vector<string> found;
+    source.ForEach(prefix, [&](StringView word) {
+        found.push_back(string(word.data(), word.size()));
+        return true;
+    });
+    return found;
+}
+
+static void testCompletionTrie()
+{
+    CompletionTrie trie;
+    // Words sharing prefixes split edges in every way: a word inside
+    // another, one extending it, and one branching off in its middle.
+    for (const char* word: {"shutdown", "show", "sh", "shell", "history", "show", "s", "help"}) trie.Add(word);
+    check(trie.Size() == 7, "trie size without repeated words");
+    check(wordsFrom(trie, "") == vector<string>({"help", "history", "s", "sh", "shell", "show", "shutdown"}),
+          "trie enumeration in byte order");
+    check(wordsFrom(trie, "sh") == vector<string>({"sh", "shell", "show", "shutdown"}), "trie prefix ending on a word");
+    check(wordsFrom(trie, "shu") == vector<string>({"shutdown"}), "trie prefix inside an edge");
+    check(wordsFrom(trie, "shx").empty() && wordsFrom(trie, "showing").empty(), "trie missing prefix");
+
+    size_t seen = 0;
+    trie.ForEach("", [&](StringView) { return ++seen < 2; });
+    check(seen == 2, "trie enumeration stopped early");
+
+    Completions out;
+    trie.Complete(StringView("x he"), 4, out);
+    check(out.Size() == 1 && out.Text(0) == StringView("help") && out.Start(0) == 2 && out.End(0) == 4,
+          "trie completes the word under the cursor");
+
+    TestTerminal t;
+    t.editor->SetCompletionRangeCallback(trie.Callback());
+    check(t.type("hi\t\r") == "history", "trie completion typed");
+
+    trie.Clear();
+    check(trie.Size() == 0 && wordsFrom(trie, "").empty(), "trie cleared");
+}
+
+// The candidates of 'c', as text.
+static vector<string> texts(const Completions& c)
+{
+    vector<string> out;
+    for (size_t i = 0; i < c.Size(); i++) out.push_back(string(c.Text(i).data(), c.Text(i).size()));
+    return out;
+}
+
+static void testNarrowCompletions()
+{
+    // Candidates for "sh" at 2 in "x sh y", narrowed after typing "o".
+    Completions c;
+    for (const char* word: {"shell", "show", "shutdown", "showing"}) c.Add(2, 4, StringView(word));
+    check(narrowCompletions(c, StringView("x sho y"), 4, 1), "candidates narrowed");
+    check(texts(c) == vector<string>({"show", "showing"}), "candidates not matching dropped");
+    check(c.Start(0) == 2 && c.End(0) == 5 && c.End(1) == 5, "candidate ranges follow the text typed");
+    Completions fresh;
+    for (const char* word: {"show", "showing"}) fresh.Add(2, 5, StringView(word));
+    check(c.Bytes() == fresh.Bytes(), "arena compacted");
+    check(narrowCompletions(c, StringView("x shox y"), 5, 1) && c.Empty(), "every candidate dropped");
+
+    Completions elsewhere;
+    elsewhere.Add(0, 1, StringView("a"));
+    elsewhere.Add(4, 6, StringView("bc"));
+    check(!narrowCompletions(elsewhere, StringView("a   bcd"), 6, 1) && elsewhere.Size() == 2,
+          "candidates away from the cursor kept");
+
+    // The editor filters the candidates of the previous Tab instead of
+    // asking the callback again, unless they are not narrowable. Tab
+    // cycles through the three candidates, then back to what was typed.
+    CompletionTrie trie;
+    for (const char* word: {"shell", "show", "shutdown"}) trie.Add(word);
+    int calls = 0;
+    bool narrowable = true;
+    TestTerminal t;
+    t.editor->SetCompletionRangeCallback([&](StringView buffer, size_t pos, Completions& out) {
+        calls++;
+        trie.Complete(buffer, pos, out);
+        out.SetNarrowable(narrowable);
+    });
+    check(t.type("s\t\t\t\thu\t\r") == "shutdown" && calls == 1, "completions narrowed on the next Tab");
+    check(t.type("s\t\t\t\t\x1b[Dx\t\r") == "xs" && calls == 3, "completions not reused after moving");
+    narrowable = false;
+    check(t.type("s\t\t\t\thu\t\r") == "shutdown" && calls == 5, "completions not narrowable asked again");
+}
+
+static void testRanking()
+{
+    check(ScoreCompletion("", "anything") > 0, "empty text scores every candidate");
+    check(ScoreCompletion("gco", "git-commit") >= 0, "characters in order match");
+    check(ScoreCompletion("GCO", "git-commit") == ScoreCompletion("gco", "git-commit"), "case ignored");
+    check(ScoreCompletion("ocg", "git-commit") < 0, "characters out of order dropped");
+    check(ScoreCompletion("sh", "show") > ScoreCompletion("sh", "push"), "prefix ranked first");
+    check(ScoreCompletion("gc", "git-commit") > ScoreCompletion("gc", "gxxxxxxc"), "word starts ranked higher");
+    check(ScoreCompletion("sh", "show") > ScoreCompletion("sh", "shutdown"), "shorter ranked higher");
+
+    // The best 'k' of the candidates as they are added, best first and
+    // ties in the order added; dropping any makes the set not narrowable.
+    Completions c;
+    c.BeginRanking(ScoreCompletion, 3, StringView("x sh"), 4);
+    for (const char* word: {"push", "shutdown", "nope", "sh", "show", "shell"}) c.Add(2, 4, StringView(word));
+    c.EndRanking();
+    check(texts(c) == vector<string>({"sh", "show", "shell"}), "top candidates best first");
+    check(!c.Narrowable(), "ranked set missing candidates not narrowable");
+
+    c.Clear();
+    c.BeginRanking([](StringView, StringView) { return 1; }, 0, StringView("a"), 1);
+    for (const char* word: {"ab", "aa", "ac"}) c.Add(0, 1, StringView(word));
+    c.EndRanking();
+    check(texts(c) == vector<string>({"ab", "aa", "ac"}) && c.Narrowable(), "ties kept in order added");
+
+    // Many candidates through a bound keep the arena compacted.
+    c.Clear();
+    c.BeginRanking([](StringView, StringView word) { return static_cast<int>(word.size()); }, 2, StringView(""), 0);
+    for (int i = 0; i < 100000; i++) c.Add(0, 0, StringView(string(i % 1000 + 1, 'x')));
+    c.EndRanking();
+    check(c.Size() == 2 && c.Text(0).size() == 1000 && c.Text(1).size() == 1000, "bounded ranking");
+    check(c.Bytes() < 4096, "bounded ranking memory");
+
+    TestTerminal t;
+    t.editor->SetCompletionRangeCallback([](StringView buffer, size_t, Completions& out) {
+        for (const char* word: {"grep-count", "gc", "git-commit"}) out.Add(0, buffer.size(), StringView(word));
+    });
+    t.editor->SetCompletionRanking(ScoreCompletion, 1);
+    check(t.type("gco\t\r") == "git-commit", "editor ranks the candidates");
+}
+
+// The candidates CompletionPaths gives for the whole of 'buffer'.
+static vector<string> paths(CompletionPaths& completer, const string& buffer)
+{
+    Completions out;
+    completer.Complete(StringView(buffer), buffer.size(), out);
+    return texts(out);
+}
+
+static void testCompletionPaths()
+{
+    char dir[] = "/tmp/linenoise-test-XXXXXX";
+    check(mkdtemp(dir) != NULL, "paths temporary directory");
+    const string d = dir;
+    for (const char* name: {"a b.txt", "it's", "plain", ".hidden"}) {
+        FILE* f = fopen((d + "/" + name).c_str(), "w");
+        if (f) fclose(f);
+    }
+    check(mkdir((d + "/sub").c_str(), 0700) == 0, "paths subdirectory");
+
+    CompletionPaths completer;
+    check(paths(completer, "ls " + d + "/a") == vector<string>({d + "/a\\ b.txt"}), "path quoted with backslashes");
+    check(paths(completer, "ls '" + d + "/a") == vector<string>({"'" + d + "/a b.txt'"}), "path in single quotes");
+    check(paths(completer, "ls '" + d + "/i") == vector<string>({"'" + d + "/it'\\''s'"}), "quote in single quotes");
+    check(paths(completer, "ls \"" + d + "/i") == vector<string>({"\"" + d + "/it's\""}), "path in double quotes");
+    check(paths(completer, "ls " + d + "/a\\ b") == vector<string>({d + "/a\\ b.txt"}), "backslash typed unquoted");
+    check(paths(completer, "ls " + d + "/s") == vector<string>({d + "/sub/"}), "directory ends with a slash");
+    check(paths(completer, "ls " + d + "/").size() == 4, "hidden files left out");
+    check(paths(completer, "ls " + d + "/.") == vector<string>({d + "/.hidden"}), "hidden files typed");
+    check(paths(completer, "ls " + d + "/x").empty(), "no such path");
+
+    string home = getenv("HOME") ? getenv("HOME") : "";
+    setenv("HOME", dir, 1);
+    check(paths(completer, "ls ~") == vector<string>({"~/"}), "tilde completed to home");
+    check(paths(completer, "ls ~/pl") == vector<string>({"~/plain"}), "path under home");
+    check(paths(completer, "ls ~no-such-user-here/").empty(), "unknown user");
+    if (home.empty()) unsetenv("HOME");
+    else setenv("HOME", home.c_str(), 1);
+
+    for (const char* name: {"a b.txt", "it's", "plain", ".hidden", "sub"}) remove((d + "/" + name).c_str());
+    rmdir(dir);
+}
+
+static void testDictionary()
+{
+    char path[] = "/tmp/linenoise-test-XXXXXX";
+    int fd = mkstemp(path);
+    check(fd != -1, "dictionary temporary file");
+    if (fd == -1) return;
+    close(fd);
+
+    vector<string> words;
+    for (int i = 0; i < 1000; i++) words.push_back("word" + to_string(i));
+    words.push_back("word1");
+    words.push_back("other");
+    check(BuildDictionary(words, path), "dictionary built");
+
+    CompletionDictionary dict;
+    check(dict.Open(path), "dictionary opened");
+    check(dict.Size() == 1001, "dictionary size");
+
+    vector<string> want = {"word99", "word990", "word991", "word992", "word993", "word994",
+                           "word995", "word996", "word997", "word998", "word999"};
+    check(wordsFrom(dict, "word99") == want, "dictionary prefix lookup");
+
+    size_t all = 0;
+    dict.ForEach("", [&](StringView) { return ++all > 0; });
+    check(all == 1001, "dictionary enumeration");
+
+    size_t none = 0;
+    dict.ForEach("zzz", [&](StringView) { return ++none > 0; });
+    check(none == 0, "dictionary missing prefix");
+
+    dict.Close();
+    FILE* f = fopen(path, "wb");
+    fputs("not a dictionary", f);
+    fclose(f);
+    check(!dict.Open(path), "bad dictionary refused");
+    unlink(path);
+}
+
+// Read every line of 'fd' with Next() and with ReadLines().
+static void readAll(int fd, vector<string>& lines, bool batches)
+{
+    LineReader reader(fd);
+    if (batches) {
+        vector<StringView> batch;
+        while (reader.ReadLines(batch, 100)) {
+            for (StringView line: batch) lines.push_back(string(line.data(), line.size()));
+        }
+    } else {
+        StringView line;
+        while (reader.Next(line)) lines.push_back(string(line.data(), line.size()));
+    }
+}
+
+static void testLineReader()
+{
+    // More than one read buffer, a line longer than it and no final newline.
+    string input;
+    vector<string> want;
+    for (int i = 0; i < 50000; i++) want.push_back("line " + to_string(i));
+    want.push_back(string(LINENOISE_READ_BUFFER + 10, 'x'));
+    want.push_back("");
+    want.push_back("last");
+    for (size_t i = 0; i < want.size(); i++) {
+        input += want[i];
+        if (i + 1 < want.size()) input += '\n';
+    }
+
+    for (int batches = 0; batches < 2; batches++) {
+        int fds[2];
+        check(pipe(fds) == 0, "pipe");
+        thread writer([&] {
+            size_t done = 0;
+            while (done < input.size()) {
+                ssize_t n = write(fds[1], input.data() + done, input.size() - done);
+                if (n <= 0) break;
+                done += n;
+            }
+            close(fds[1]);
+        });
+        vector<string> lines;
+        readAll(fds[0], lines, batches != 0);
+        writer.join();
+        close(fds[0]);
+        check(lines == want, batches ? "pipe lines in batches" : "pipe lines");
+    }
+
+    char path[] = "/tmp/linenoise-test-XXXXXX";
+    int fd = mkstemp(path);
+    check(fd != -1, "lines temporary file");
+    if (fd == -1) return;
+    unlink(path);
+    check(write(fd, input.data(), input.size()) == static_cast<ssize_t>(input.size()), "lines written");
+    for (int batches = 0; batches < 2; batches++) {
+        lseek(fd, 0, SEEK_SET);
+        vector<string> lines;
+        readAll(fd, lines, batches != 0);
+        check(lines == want, batches ? "file lines in batches" : "file lines");
+    }
+
+    // A mapped file is left positioned after the lines taken.
+    lseek(fd, 0, SEEK_SET);
+    {
+        LineReader reader(fd);
+        StringView line;
+        reader.Next(line);
+    }
+    check(lseek(fd, 0, SEEK_CUR) == static_cast<off_t>(want[0].size() + 1), "file offset after reader");
+
+    // Lines appended to a mapped file while it is read are not missed.
+    check(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0, "lines file emptied");
+    check(write(fd, "one\ntwo\n", 8) == 8, "lines file written");
+    lseek(fd, 0, SEEK_SET);
+    {
+        LineReader reader(fd);
+        StringView line;
+        vector<string> lines;
+        if (reader.Next(line)) lines.push_back(string(line.data(), line.size()));
+        check(pwrite(fd, "three\n", 6, 8) == 6, "lines appended");
+        while (reader.Next(line)) lines.push_back(string(line.data(), line.size()));
+        check(lines == vector<string>({"one", "two", "three"}), "lines appended to a mapped file");
+    }
+    close(fd);
+}
+
+static void testSessionServer()
+{
+    int a[2], b[2], c[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, a) == -1 || socketpair(AF_UNIX, SOCK_STREAM, 0, b) == -1 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, c) == -1) {
+        check(false, "session socket pairs");
+        return;
+    }
+    SessionServer server;
+    vector<pair<int, string>> lines;
+    vector<int> closed;
+    int ida = server.Add(a[0], a[0], "a> ", 80, 24);
+    int idb = server.Add(b[0], b[0], "b> ", 80, 24);
+    int idc = -1;
+    server.SetLineCallback([&](int session, const string& line) {
+        lines.push_back(make_pair(session, line));
+        if (line == "flood") server.Write(session, string(256 << 10, 'x'));
+        if (line == "replace") {
+            // Reuses the id of b, whose input is in the same batch.
+            server.Close(idb);
+            idc = server.Add(c[0], c[0], "c> ", 80, 24);
+        }
+    });
+    server.SetCloseCallback([&](int session) { closed.push_back(session); });
+    check(ida >= 0 && idb >= 0 && ida != idb && server.Size() == 2, "sessions added");
+
+    auto poll = [&]() {
+        for (int i = 0; i < 10; i++) server.Poll(10);
+    };
+    auto drain = [](int fd) {
+        char buf[4096];
+        while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+    };
+
+    if (write(a[1], "one\r", 4) != 4 || write(b[1], "two\r", 4) != 4) check(false, "typed");
+    poll();
+    check(lines.size() == 2 && lines[0].second != lines[1].second, "lines of two sessions");
+
+    // A client that does not read does not stall the others.
+    lines.clear();
+    if (write(b[1], "flood\r", 6) != 6) check(false, "typed");
+    poll();
+    check(server.GetEditor(idb).PendingOutput() > 0, "unread output queued");
+    if (write(a[1], "still\r", 6) != 6) check(false, "typed");
+    poll();
+    check(lines.size() == 2 && lines[1] == make_pair(ida, string("still")), "other session served");
+    for (int i = 0; i < 100 && server.GetEditor(idb).PendingOutput(); i++) {
+        drain(b[1]);
+        server.Poll(10);
+    }
+    check(server.GetEditor(idb).PendingOutput() == 0, "queued output written");
+
+    // Until it lets too much pile up.
+    for (int i = 0; i < 8 && closed.empty(); i++) {
+        if (write(b[1], "flood\r", 6) != 6) check(false, "typed");
+        poll();
+    }
+    check(closed == vector<int>{idb} && server.Size() == 1, "flooded session closed");
+    drain(a[1]);
+
+    // An event for a closed session does not reach a new one with its id.
+    idb = server.Add(b[0], b[0], "b> ", 80, 24);
+    lines.clear();
+    if (write(a[1], "replace\r", 8) != 8 || write(b[1], "lost\r", 5) != 5) check(false, "typed");
+    poll();
+    check(idc == idb && lines.size() == 1, "event of a replaced session dropped");
+    if (write(c[1], "three\r", 6) != 6) check(false, "typed");
+    poll();
+    check(lines.size() == 2 && lines[1] == make_pair(idc, string("three")), "replacing session served");
+
+    // A client that went away ends its session without SIGPIPE.
+    closed.clear();
+    close(c[1]);
+    server.Write(idc, "bye\r\n");
+    poll();
+    check(closed == vector<int>{idc}, "session of a closed client ended");
+
+    for (int* fds: {a, b, c}) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+int main()
+{
+    testDecodeKey();
+    testKeymap();
+    testEditFeed();
+    testSuggestions();
+    testHistory();
+    testCompletionTrie();
+    testNarrowCompletions();
+    testRanking();
+    testCompletionPaths();
+    testDictionary();
+    testLineReader();
+    testSessionServer();
+    if (failures) {
+        cerr << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "all checks passed" << endl;
+    return 0;
+}
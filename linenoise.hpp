@@ -126,7 +126,19 @@
 #ifndef _WIN32
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <signal.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#endif
 #else
 #ifndef NOMINMAX
 #define NOMINMAX
@@ -151,15 +163,284 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string>
 #include <fstream>
+#include <iterator>
 #include <functional>
 #include <vector>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#endif
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <optional>
+#define LINENOISE_COROUTINES 1
+#endif
+#endif
 
 namespace linenoise {
 
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+typedef std::string_view StringView;
+#else
+/* The subset of std::string_view used by this library, for C++11/14. */
+class StringView {
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    StringView() : ptr(""), len(0) {}
+    StringView(const char *s) : ptr(s), len(strlen(s)) {}
+    StringView(const char *s, size_t n) : ptr(s), len(n) {}
+    StringView(const std::string& s) : ptr(s.data()), len(s.size()) {}
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+    size_t length() const { return len; }
+    bool empty() const { return len == 0; }
+    const char *begin() const { return ptr; }
+    const char *end() const { return ptr + len; }
+    const char& operator[](size_t i) const { return ptr[i]; }
+
+    StringView substr(size_t pos, size_t n = npos) const {
+        return StringView(ptr + pos, std::min(n, len - pos));
+    }
+    int compare(StringView o) const {
+        int r = memcmp(ptr, o.ptr, std::min(len, o.len));
+        return r ? r : (len < o.len ? -1 : (len > o.len ? 1 : 0));
+    }
+    explicit operator std::string() const { return std::string(ptr, len); }
+
+private:
+    const char *ptr;
+    size_t len;
+};
+
+inline bool operator==(StringView a, StringView b) { return a.compare(b) == 0; }
+inline bool operator!=(StringView a, StringView b) { return a.compare(b) != 0; }
+inline bool operator<(StringView a, StringView b) { return a.compare(b) < 0; }
+#endif
+
+/* Scores a candidate for the text typed between its start and the
+ * cursor: higher is better, below zero drops it. */
+typedef std::function<int (StringView typed, StringView candidate)> CompletionScoreCallback;
+
+/* Completion candidates, each replacing the range [start, end) of the
+ * edited buffer. The text of all the candidates is appended to a single
+ * buffer kept from one Tab to the next, so once it has grown adding
+ * candidates does not allocate. */
+class Completions {
+public:
+    Completions() : narrowable(true), limit(0), pos(0), seq(0), garbage(0), dropped(false) {}
+
+    void Add(size_t start, size_t end, StringView text) {
+        if (!score) {
+            Entry e = { start, end, arena.size(), text.size(), 0, 0 };
+            arena.append(text.data(), text.size());
+            entries.push_back(e);
+            return;
+        }
+        StringView typed;
+        if (start <= pos && pos <= buffer.size()) typed = StringView(buffer).substr(start, pos - start);
+        Entry e = { start, end, arena.size(), text.size(), score(typed, text), seq++ };
+        if (e.score < 0) {
+            dropped = true;
+            return;
+        }
+        /* entries is a heap with the worst candidate kept at its front. */
+        if (limit && entries.size() == limit) {
+            dropped = true;
+            if (!better(e, entries.front())) return;
+            std::pop_heap(entries.begin(), entries.end(), better);
+            garbage += entries.back().length;
+            entries.pop_back();
+        }
+        arena.append(text.data(), text.size());
+        entries.push_back(e);
+        std::push_heap(entries.begin(), entries.end(), better);
+        if (garbage > 4096 && garbage > arena.size() / 2) compact();
+    }
+
+    void Clear() {
+        entries.clear();
+        arena.clear();
+        narrowable = true;
+        score = nullptr;
+        garbage = 0;
+    }
+
+    /* Rank the candidates added until EndRanking() by 'fn', keeping only
+     * the 'k' best ones (all of them when 0) as they are added, so memory
+     * stays bounded however many the callback yields. 'typed' and
+     * 'cursor' are the buffer and position the candidates are computed for. */
+    void BeginRanking(CompletionScoreCallback fn, size_t k, StringView typed, size_t cursor) {
+        score = fn;
+        limit = k;
+        buffer.assign(typed.data(), typed.size());
+        pos = cursor;
+        seq = 0;
+        dropped = false;
+    }
+
+    /* Order the ranked candidates best first, ties in the order they were
+     * added. A set missing dropped candidates cannot be narrowed. */
+    void EndRanking() {
+        if (!score) return;
+        std::sort_heap(entries.begin(), entries.end(), better);
+        compact();
+        if (dropped) narrowable = false;
+        score = nullptr;
+    }
+
+    /* Narrowable candidates are all the words starting with the text
+     * between their start and the cursor, so when more is typed they are
+     * filtered instead of asking the callback again. Set it to false for
+     * candidates chosen otherwise, e.g. by fuzzy matching. */
+    void SetNarrowable(bool n) { narrowable = n; }
+    bool Narrowable() const { return narrowable; }
+
+    size_t Size() const { return entries.size(); }
+    bool Empty() const { return entries.empty(); }
+    size_t Bytes() const { return arena.size() + entries.size() * sizeof(Entry); }
+    size_t Start(size_t i) const { return entries[i].start; }
+    size_t End(size_t i) const { return entries[i].end; }
+
+    /* Valid until the next call to Add() or Clear(). */
+    StringView Text(size_t i) const {
+        return StringView(arena.data() + entries[i].offset, entries[i].length);
+    }
+
+private:
+    struct Entry {
+        size_t start;
+        size_t end;
+        size_t offset;
+        size_t length;
+        int score;
+        size_t seq;
+    };
+
+    static bool better(const Entry& a, const Entry& b) {
+        return a.score > b.score || (a.score == b.score && a.seq < b.seq);
+    }
+
+    /* Drop the text of the candidates evicted from the arena. */
+    void compact() {
+        std::string packed;
+        packed.reserve(arena.size() - garbage);
+        for (auto& e: entries) {
+            packed.append(arena, e.offset, e.length);
+            e.offset = packed.size() - e.length;
+        }
+        arena.swap(packed);
+        garbage = 0;
+    }
+
+    std::vector<Entry> entries;
+    std::string arena;
+    bool narrowable;
+
+    /* Ranking state, between BeginRanking() and EndRanking(). */
+    CompletionScoreCallback score;
+    size_t limit;
+    std::string buffer;
+    size_t pos;
+    size_t seq;
+    size_t garbage;
+    bool dropped;
+
+    friend bool narrowCompletions(Completions& c, StringView buffer, size_t pos, size_t inserted);
+};
+
+/* Narrow the candidates computed with the cursor at 'pos' after
+ * 'inserted' bytes were typed there, giving 'buffer'. The candidates that
+ * no longer start with the text between their start and the cursor are
+ * removed, compacting the arena in place. Returns false, leaving the
+ * candidates untouched, when a candidate range does not contain 'pos'. */
+inline bool narrowCompletions(Completions& c, StringView buffer, size_t pos, size_t inserted) {
+    for (const auto& e: c.entries) {
+        if (e.start > pos || e.end < pos) return false;
+    }
+    size_t cursor = pos + inserted;
+    size_t j = 0, used = 0;
+    for (size_t i = 0; i < c.entries.size(); i++) {
+        Completions::Entry e = c.entries[i];
+        StringView typed = buffer.substr(e.start, cursor - e.start);
+        if (e.length < typed.size() || memcmp(c.arena.data() + e.offset, typed.data(), typed.size())) continue;
+        memmove(&c.arena[0] + used, c.arena.data() + e.offset, e.length);
+        e.offset = used;
+        e.end += inserted;
+        used += e.length;
+        c.entries[j++] = e;
+    }
+    c.entries.resize(j);
+    c.arena.resize(used);
+    return true;
+}
+
+/* A default completion score: candidates not containing the typed
+ * characters in order (ignoring ASCII case) are dropped, and the others
+ * rank higher when they start with the typed text, when the characters
+ * match consecutively or at word starts, and when they are shorter.
+ * Combine it with other signals, e.g. use frequencies, in your own
+ * CompletionScoreCallback. */
+inline int ScoreCompletion(StringView typed, StringView candidate) {
+    if (typed.empty()) return 1;
+    int score = 1000;
+    size_t j = 0, last = 0;
+    for (size_t i = 0; i < typed.size(); i++) {
+        unsigned char t = tolower((unsigned char)typed[i]);
+        while (j < candidate.size() && tolower((unsigned char)candidate[j]) != t) j++;
+        if (j == candidate.size()) return -1;
+        if (i && j == last + 1) score += 10;
+        else if (i) score -= std::min<size_t>(j - last, 20);
+        if (j == 0 || strchr(" _-./", candidate[j - 1])) score += 5;
+        last = j++;
+    }
+    if (candidate.substr(0, typed.size()) == typed) score += 100;
+    score -= static_cast<int>(std::min<size_t>(candidate.size() - typed.size(), 100));
+    return std::max(score, 0);
+}
+
+/* Tells an asynchronous completion callback that its result is no longer
+ * wanted, so it can stop early. */
+class CancellationToken {
+public:
+    CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+    bool Cancelled() const { return flag->load(std::memory_order_relaxed); }
+    void Cancel() const { flag->store(true, std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
 typedef std::function<void (const char*, std::vector<std::string>&)> CompletionCallback;
+typedef std::function<void (StringView buffer, size_t pos, Completions&)> CompletionRangeCallback;
+typedef std::function<void (StringView buffer, size_t pos, Completions&, const CancellationToken&)> AsyncCompletionCallback;
+typedef std::function<bool (std::string& candidate)> CompletionGenerator;
+typedef std::function<CompletionGenerator (StringView buffer, size_t pos, size_t& start, size_t& end)> CompletionMenuCallback;
+typedef std::function<std::string (const char*, int& color, int& bold)> HintsCallback;
+
+/* A run of the edited buffer drawn with an ANSI color and/or in bold. */
+struct HighlightSpan {
+    int offset;  /* Byte offset in the buffer. */
+    int length;  /* Length in bytes. */
+    int color;   /* ANSI color, -1 for the default one. */
+    int bold;    /* Bold when 1. */
+};
+typedef std::function<void (const char*, int len, int start, int end, std::vector<HighlightSpan>&)> HighlightCallback;
 
 #ifdef _WIN32
 
@@ -1062,24 +1343,50 @@ inline int win32_write(int fd, const void *buffer, unsigned int count) {
 
 #define LINENOISE_DEFAULT_HISTORY_MAX_LEN 100
 #define LINENOISE_MAX_LINE 4096
+#define LINENOISE_SESSION_EVENTS 256 /* Events handled per epoll_wait(). */
+#define LINENOISE_SESSION_MAX_OUTPUT (1 << 20) /* Output queued per session. */
+#define LINENOISE_EDIT_MORE -2 /* linenoiseEditFeed(): the line is not done. */
+#define LINENOISE_DEFAULT_HINTS_BUDGET_MS 10
+#define LINENOISE_HINTS_CACHE_MAX 1024
+#define LINENOISE_INPUT_BUFFER 1024 /* Bytes of terminal input read at once. */
+#define LINENOISE_MAX_SEQUENCE 32 /* Longest escape sequence decoded. */
+#define LINENOISE_DEFAULT_ESCAPE_TIMEOUT_MS 50
+#define LINENOISE_DEFAULT_PROBE_TIMEOUT_MS 500
 static const char *unsupported_term[] = {"dumb","cons25","emacs",NULL};
-static CompletionCallback completionCallback;
-
-#ifndef _WIN32
-static struct termios orig_termios; /* In order to restore at exit.*/
-#endif
-static bool rawmode = false; /* For atexit() function to check if restore is needed*/
-static bool mlmode = false;  /* Multi line mode. Default is single line. */
-static bool atexit_registered = false; /* Register atexit just 1 time. */
-static size_t history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
-static std::vector<std::string> history;
+#define LINENOISE_COMPLETION_CACHE_MAX (1 << 20) /* Bytes */
+static std::atomic<bool> atexit_registered(false); /* Register atexit just 1 time. */
+/* A completion computed by completion_worker for a state of the buffer. */
+struct CompletionRequest {
+    CompletionRequest() : done(false) {}
+    std::string buffer;        /* Copy of the buffer to complete. */
+    size_t pos;                /* Cursor position in it. */
+    unsigned long generation;  /* linenoiseState::generation of the buffer. */
+    CancellationToken token;
+    Completions result;
+    std::atomic<bool> done;    /* 'result' is complete. */
+};
 
 /* The linenoiseState structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
  * functionalities. */
+/* The terminal output of an editor: a non-blocking one may take only part
+ * of a write, the rest waits in 'queue' and is written first from then on. */
+struct TerminalOutput {
+    explicit TerminalOutput(int output_fd) : fd(output_fd), is_socket(false) {
+#ifndef _WIN32
+        struct stat st;
+        is_socket = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+#endif
+    }
+    int fd;
+    bool is_socket;  /* Written with send(), not to raise SIGPIPE. */
+    std::string queue;
+};
+
 struct linenoiseState {
     int ifd;            /* Terminal stdin file descriptor. */
     int ofd;            /* Terminal stdout file descriptor. */
+    TerminalOutput *output; /* Writes to 'ofd', see linenoiseWrite(). */
     char *buf;          /* Edited line buffer. */
     int buflen;         /* Edited line buffer size. */
     std::string prompt; /* Prompt to display. */
@@ -1089,6 +1396,35 @@ struct linenoiseState {
     int cols;           /* Number of columns in terminal. */
     int maxrows;        /* Maximum num of rows used so far (multiline mode) */
     int history_index;  /* The history index we are currently editing. */
+    bool search_active; /* Prefix history search in progress. */
+    std::string search_orig;  /* Line being edited when the search started. */
+    std::string search_shown; /* Line last shown by the search. */
+    size_t search_prefix;     /* Length of the searched prefix. */
+    unsigned long search_hit; /* Sequence number shown, ULONG_MAX for 'search_orig'. */
+    std::string suggestion;  /* Ghost text shown after the cursor. */
+    std::string suggest_for; /* Buffer 'suggest_hit' was looked up for. */
+    unsigned long suggest_hit; /* History entry suggested, or ULONG_MAX. */
+    std::string hint;   /* Hint shown after the buffer. */
+    int hint_color;     /* Hint color, -1 for the default one. */
+    int hint_bold;      /* Hint in bold when 1. */
+    bool hint_waiting;  /* The hint for the buffer is still being computed. */
+    std::vector<HighlightSpan> hl_spans; /* Highlighting of the buffer, sorted. */
+    int hl_dirty_start; /* Range edited since the last highlighting, */
+    int hl_dirty_end;   /* hl_dirty_start is -1 when there is none. */
+    unsigned long generation; /* Incremented on every change of the buffer. */
+    std::shared_ptr<CompletionRequest> completion_request; /* In flight. */
+    std::shared_ptr<CompletionRequest> completion_prefetch; /* Computed while idle. */
+    int cycle_index;    /* Completion shown by Tab, -1 when not cycling. */
+    int cycle_size;     /* Completions cycled through. */
+    int cycle_pos;      /* Cursor position before cycling. */
+    int cycle_start;    /* Buffer range of the completion shown, */
+    int cycle_len;      /* cycle_len is -1 when there is none. */
+    std::string cycle_replaced; /* Original text under the completion shown. */
+    CompletionGenerator menu_next; /* Candidates left for the completion menu. */
+    std::string menu_carry; /* Candidate pulled for the next menu page. */
+    bool menu_has_carry;
+    bool menu_waiting;  /* The completion menu waits at --More--. */
+    std::chrono::steady_clock::time_point idle_since; /* Time of the last key. */
 };
 
 enum KEY_ACTION {
@@ -1113,9 +1449,28 @@ enum KEY_ACTION {
     BACKSPACE =  127    /* Backspace */
 };
 
+/* Keys decoded from the terminal input are a Unicode code point or one of
+ * these keys, ORed with the modifiers held. */
+enum KEY_CODE {
+    UNKNOWN_KEY = 0x110000, /* Sequence not recognized, ignored. */
+    ARROW_UP,
+    ARROW_DOWN,
+    ARROW_RIGHT,
+    ARROW_LEFT,
+    HOME_KEY,
+    END_KEY,
+    INSERT_KEY,
+    DEL_KEY,
+    PAGE_UP,
+    PAGE_DOWN,
+    F1_KEY, F2_KEY, F3_KEY, F4_KEY, F5_KEY, F6_KEY,
+    F7_KEY, F8_KEY, F9_KEY, F10_KEY, F11_KEY, F12_KEY,
+    MOD_SHIFT = 1 << 24,
+    MOD_ALT = 1 << 25,
+    MOD_CTRL = 1 << 26
+};
+
 void linenoiseAtExit(void);
-bool AddHistory(const char *line);
-void refreshLine(struct linenoiseState *l);
 
 /* ============================ UTF8 utilities ============================== */
 
@@ -1542,800 +1897,4353 @@ inline int unicodeColumnPosForMultiLine(char* buf, int buf_len, int pos, int col
     return ret;
 }
 
-/* Read UTF8 character from file.
- */
-inline int unicodeReadUTF8Char(int fd, char* buf, int* cp)
-{
-    int nread = read(fd,&buf[0],1);
-
-    if (nread <= 0) { return nread; }
-
-    unsigned char byte = buf[0];
-
-    if ((byte & 0x80) == 0) {
-        ;
-    } else if ((byte & 0xE0) == 0xC0) {
-        nread = read(fd,&buf[1],1);
-        if (nread <= 0) { return nread; }
-    } else if ((byte & 0xF0) == 0xE0) {
-        nread = read(fd,&buf[1],2);
-        if (nread <= 0) { return nread; }
-    } else if ((byte & 0xF8) == 0xF0) {
-        nread = read(fd,&buf[1],3);
-        if (nread <= 0) { return nread; }
-    } else {
-        return -1;
+/* ============================== Key decoding ============================== */
+
+/* Keys of the CSI sequences ESC [ <params> <final>, by final byte, and of
+ * the SS3 sequences ESC O <final>. Lower case finals are rxvt's. */
+struct KeySequenceFinal {
+    char final;
+    int key;
+};
+
+static const KeySequenceFinal linenoiseCsiKeys[] = {
+    {'A', ARROW_UP}, {'B', ARROW_DOWN}, {'C', ARROW_RIGHT}, {'D', ARROW_LEFT},
+    {'H', HOME_KEY}, {'F', END_KEY}, {'P', F1_KEY}, {'Q', F2_KEY},
+    {'R', F3_KEY}, {'S', F4_KEY}, {'Z', static_cast<int>(TAB) | MOD_SHIFT},
+    {'a', ARROW_UP | MOD_SHIFT}, {'b', ARROW_DOWN | MOD_SHIFT},
+    {'c', ARROW_RIGHT | MOD_SHIFT}, {'d', ARROW_LEFT | MOD_SHIFT},
+};
+
+static const KeySequenceFinal linenoiseSs3Keys[] = {
+    {'A', ARROW_UP}, {'B', ARROW_DOWN}, {'C', ARROW_RIGHT}, {'D', ARROW_LEFT},
+    {'H', HOME_KEY}, {'F', END_KEY}, {'P', F1_KEY}, {'Q', F2_KEY},
+    {'R', F3_KEY}, {'S', F4_KEY}, {'M', ENTER},
+    {'a', ARROW_UP | MOD_CTRL}, {'b', ARROW_DOWN | MOD_CTRL},
+    {'c', ARROW_RIGHT | MOD_CTRL}, {'d', ARROW_LEFT | MOD_CTRL},
+};
+
+/* Keys of the sequences ESC [ <number> ~, by number. */
+static const int linenoiseTildeKeys[] = {
+    UNKNOWN_KEY, HOME_KEY, INSERT_KEY, DEL_KEY, END_KEY, PAGE_UP, PAGE_DOWN,
+    HOME_KEY, END_KEY, UNKNOWN_KEY, UNKNOWN_KEY, F1_KEY, F2_KEY, F3_KEY,
+    F4_KEY, F5_KEY, UNKNOWN_KEY, F6_KEY, F7_KEY, F8_KEY, F9_KEY, F10_KEY,
+    UNKNOWN_KEY, F11_KEY, F12_KEY,
+};
+
+template <size_t N>
+inline int linenoiseFinalKey(const KeySequenceFinal (&table)[N], char final) {
+    for (size_t i = 0; i < N; i++) {
+        if (table[i].final == final) return table[i].key;
     }
+    return UNKNOWN_KEY;
+}
 
-    return unicodeUTF8CharToCodePoint(buf, 4, cp);
+/* Modifiers of the xterm parameter 1 + (shift | alt << 1 | ctrl << 2 | meta << 3). */
+inline int linenoiseKeyModifiers(int param) {
+    int bits = param > 1 ? param - 1 : 0;
+    return (bits & 1 ? MOD_SHIFT : 0) | (bits & 10 ? MOD_ALT : 0) | (bits & 4 ? MOD_CTRL : 0);
 }
 
-/* ======================= Low level terminal handling ====================== */
+/* Decode the key at the start of the 'len' bytes of terminal input 'buf'
+ * into *key, from the tables above rather than with more reads. Returns
+ * the number of bytes of the key, or 0 when they may start a longer
+ * sequence. Once 'complete' is set, e.g. after the escape timeout, they are
+ * decoded as they are, so that a lone ESC is the Escape key. */
+inline int linenoiseDecodeKey(const char *buf, int len, bool complete, int *key) {
+    unsigned char c = buf[0];
+    if (c != ESC) {
+        int n = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+        if (n == 0) {
+            *key = UNKNOWN_KEY;
+            return 1;
+        }
+        if (len < n) {
+            if (!complete) return 0;
+            *key = UNKNOWN_KEY;
+            return len;
+        }
+        unicodeUTF8CharToCodePoint(buf, n, key);
+        return n;
+    }
+    if (len == 1) {
+        if (!complete) return 0;
+        *key = ESC;
+        return 1;
+    }
 
-/* Set if to use or not the multi line mode. */
-inline void SetMultiLine(bool ml) {
-    mlmode = ml;
-}
+    c = buf[1];
+    if (c == 'O') {
+        /* ESC O <final> */
+        if (len == 2) {
+            if (!complete) return 0;
+            *key = 'O' | MOD_ALT;
+            return 2;
+        }
+        *key = linenoiseFinalKey(linenoiseSs3Keys, buf[2]);
+        return 3;
+    }
+    if (c != '[') {
+        /* Alt held: ESC and the key, which may be a sequence itself. */
+        int n = linenoiseDecodeKey(buf + 1, len - 1, complete, key);
+        if (n == 0) return 0;
+        if (*key != UNKNOWN_KEY) *key |= MOD_ALT;
+        return n + 1;
+    }
 
-/* Return true if the terminal name is in the list of terminals we know are
- * not able to understand basic escape sequences. */
-inline bool isUnsupportedTerm(void) {
-#ifndef _WIN32
-    char *term = getenv("TERM");
-    int j;
+    /* ESC [ [ A to ESC [ [ E are the F1 to F5 of the Linux console. */
+    if (len > 2 && buf[2] == '[') {
+        if (len == 3) {
+            if (!complete) return 0;
+            *key = UNKNOWN_KEY;
+            return 3;
+        }
+        *key = buf[3] >= 'A' && buf[3] <= 'E' ? F1_KEY + (buf[3] - 'A') : UNKNOWN_KEY;
+        return 4;
+    }
 
-    if (term == NULL) return false;
-    for (j = 0; unsupported_term[j]; j++)
-        if (!strcasecmp(term,unsupported_term[j])) return true;
-#endif
-    return false;
+    /* ESC [ ? and ESC [ > start reports of the terminal, like replies to
+     * ProbeTerminal() arriving after its deadline, not keys. */
+    if (len > 2 && (buf[2] == '?' || buf[2] == '>')) {
+        for (int j = 3; j < len && j < LINENOISE_MAX_SEQUENCE; j++) {
+            if (buf[j] >= 0x40 && buf[j] <= 0x7E) {
+                *key = UNKNOWN_KEY;
+                return j + 1;
+            }
+        }
+        if (len < LINENOISE_MAX_SEQUENCE && !complete) return 0;
+        *key = UNKNOWN_KEY;
+        return std::min(len, static_cast<int>(LINENOISE_MAX_SEQUENCE));
+    }
+
+    /* ESC [ <number> ; <modifiers> <final> */
+    int params[2] = {0, 0};
+    int nparams = 0;
+    int i;
+    for (i = 2; i < len && i < LINENOISE_MAX_SEQUENCE; i++) {
+        c = buf[i];
+        if (c >= '0' && c <= '9') {
+            if (nparams < 2 && params[nparams] < 1000) params[nparams] = params[nparams] * 10 + (c - '0');
+        } else if (c == ';') {
+            nparams++;
+        } else if (c < 0x20 || c > 0x3F || c == '$') {
+            break; /* The final byte; rxvt ends modified keys with '$'. */
+        }
+    }
+    if (i == len) {
+        if (!complete) return 0;
+        *key = UNKNOWN_KEY;
+        return len;
+    }
+    if (i == LINENOISE_MAX_SEQUENCE || c < 0x20) {
+        /* Garbage, or a key typed after an unfinished sequence. */
+        *key = UNKNOWN_KEY;
+        return i;
+    }
+    int mods = linenoiseKeyModifiers(params[1]);
+    if (c == '~' || c == '$' || c == '^' || c == '@') {
+        int n = params[0];
+        *key = n < static_cast<int>(sizeof(linenoiseTildeKeys) / sizeof(linenoiseTildeKeys[0])) ? linenoiseTildeKeys[n] : UNKNOWN_KEY;
+        if (c == '$') mods |= MOD_SHIFT;
+        if (c == '^') mods |= MOD_CTRL;
+        if (c == '@') mods |= MOD_CTRL | MOD_SHIFT;
+    } else {
+        *key = linenoiseFinalKey(linenoiseCsiKeys, c);
+    }
+    if (*key != UNKNOWN_KEY) *key |= mods;
+    return i + 1;
 }
 
-/* Raw mode: 1960 magic shit. */
-inline bool enableRawMode(int fd) {
+/* ============================ Background work ============================= */
+
+/* Runs callbacks one at a time on a thread started on first use, so slow
+ * application callbacks never stall the input loop. Posting a job replaces
+ * the one still waiting to run. After each job the wake descriptor becomes
+ * readable so linenoiseEdit() can redraw while it waits for keys. */
+class BackgroundWorker {
+public:
+    BackgroundWorker() : stop(false), running(false) { wake[0] = wake[1] = -1; }
+
+    ~BackgroundWorker() {
+        if (thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cond.notify_one();
+            thread.join();
+        }
 #ifndef _WIN32
-    struct termios raw;
+        if (wake[0] != -1) { close(wake[0]); close(wake[1]); }
+#endif
+    }
 
-    if (!isatty(STDIN_FILENO)) goto fatal;
-    if (!atexit_registered) {
-        atexit(linenoiseAtExit);
-        atexit_registered = true;
+    void Post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = std::move(job);
+            if (!thread.joinable()) start();
+        }
+        cond.notify_one();
     }
-    if (tcgetattr(fd,&orig_termios) == -1) goto fatal;
 
-    raw = orig_termios;  /* modify the original mode */
-    /* input modes: no break, no CR to NL, no parity check, no strip char,
-     * no start/stop output control. */
-    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
-    /* output modes - disable post processing */
-    // NOTE: Multithreaded issue #20 (https://github.com/yhirose/cpp-linenoise/issues/20)
-    // raw.c_oflag &= ~(OPOST);
-    /* control modes - set 8 bit chars */
-    raw.c_cflag |= (CS8);
-    /* local modes - echoing off, canonical off, no extended functions,
-     * no signal chars (^Z,^C) */
-    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-    /* control chars - set return condition: min number of bytes and timer.
-     * We want read to return every single byte, without timeout. */
-    raw.c_cc[VMIN] = 1; raw.c_cc[VTIME] = 0; /* 1 byte, no timer */
+    /* A job is running or waiting to run. */
+    bool Busy() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running || pending;
+    }
 
-    /* put terminal in raw mode after flushing */
-    if (tcsetattr(fd,TCSAFLUSH,&raw) < 0) goto fatal;
-    rawmode = true;
-#else
-    if (!atexit_registered) {
-        /* Cleanup them at exit */
-        atexit(linenoiseAtExit);
-        atexit_registered = true;
+    /* Read end of the wake pipe, or -1 before the first job. */
+    int WakeFd() const { return wake[0]; }
 
-        /* Init windows console handles only once */
-        hOut = GetStdHandle(STD_OUTPUT_HANDLE);
-        if (hOut==INVALID_HANDLE_VALUE) goto fatal;
+    void ClearWake() {
+#ifndef _WIN32
+        char drain[64];
+        while (read(wake[0], drain, sizeof(drain)) > 0) {}
+#endif
     }
 
-    DWORD consolemodeOut;
-    if (!GetConsoleMode(hOut, &consolemodeOut)) {
-        CloseHandle(hOut);
-        errno = ENOTTY;
-        return false;
-    };
+private:
+    void start() {
+#ifndef _WIN32
+        if (pipe(wake) == 0) {
+            for (int i = 0; i < 2; i++) {
+                fcntl(wake[i], F_SETFL, fcntl(wake[i], F_GETFL) | O_NONBLOCK);
+                fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+            }
+        } else {
+            wake[0] = wake[1] = -1;
+        }
+#endif
+        thread = std::thread([this]() { run(); });
+    }
 
-    hIn = GetStdHandle(STD_INPUT_HANDLE);
-    if (hIn == INVALID_HANDLE_VALUE) {
-        CloseHandle(hOut);
-        errno = ENOTTY;
-        return false;
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (1) {
+            cond.wait(lock, [this]() { return stop || pending; });
+            if (stop) return;
+            std::function<void()> job;
+            job.swap(pending);
+            running = true;
+            lock.unlock();
+            job();
+#ifndef _WIN32
+            if (wake[1] != -1 && write(wake[1], "", 1) == -1) {} /* Full pipe already wakes. */
+#endif
+            lock.lock();
+            running = false;
+        }
     }
 
-    GetConsoleMode(hIn, &consolemodeIn);
-    /* Enable raw mode */
-    SetConsoleMode(hIn, consolemodeIn & ~ENABLE_PROCESSED_INPUT);
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::function<void()> pending;
+    bool stop;
+    bool running;
+    int wake[2];
+    std::thread thread;
+};
 
-    rawmode = true;
-#endif
-    return true;
+/* ============================== Terminal size ============================= */
 
-fatal:
-    errno = ENOTTY;
-    return false;
+#ifndef _WIN32
+#define LINENOISE_MAX_RESIZE_WATCHERS 64
+
+/* Bumped by SIGWINCH, so sizes cached before are asked again. */
+static std::atomic<unsigned> resize_generation(0);
+/* Write ends of the ResizeWatcher pipes plus one, 0 for a free slot. */
+static std::atomic<int> resize_pipes[LINENOISE_MAX_RESIZE_WATCHERS];
+/* SIGWINCH handlers between reading a slot and writing to its pipe. */
+static std::atomic<int> resize_handlers_running(0);
+static std::atomic<bool> resize_handler_installed(false);
+static struct sigaction resize_previous_action;
+
+/* Call the handler the program had installed before one of ours. Returns
+ * false when it had none. */
+inline bool linenoiseChainSignal(const struct sigaction& previous, int sig, siginfo_t *info, void *context) {
+    if (previous.sa_flags & SA_SIGINFO) {
+        if (!previous.sa_sigaction) return false;
+        previous.sa_sigaction(sig, info, context);
+    } else {
+        if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) return false;
+        previous.sa_handler(sig);
+    }
+    return true;
 }
 
-inline void disableRawMode(int fd) {
-#ifdef _WIN32
-    if (consolemodeIn) {
-      SetConsoleMode(hIn, consolemodeIn);
-      consolemodeIn = 0;
+/* Only async-signal-safe calls: wake every watcher, then chain to the
+ * handler the program had. */
+inline void linenoiseResizeHandler(int sig, siginfo_t *info, void *context) {
+    int saved_errno = errno;
+    resize_generation++;
+    resize_handlers_running++;
+    for (int i = 0; i < LINENOISE_MAX_RESIZE_WATCHERS; i++) {
+        int fd = resize_pipes[i].load() - 1;
+        if (fd >= 0 && write(fd, "", 1) == -1) {} /* Full pipe already wakes. */
     }
-    rawmode = false;
-#else
-    /* Don't even check the return value as it's too late. */
-    if (rawmode && tcsetattr(fd,TCSAFLUSH,&orig_termios) != -1)
-        rawmode = false;
-#endif
+    resize_handlers_running--;
+    errno = saved_errno;
+    linenoiseChainSignal(resize_previous_action, sig, info, context);
 }
+#endif
 
-/* Use the ESC [6n escape sequence to query the horizontal cursor position
- * and return it. On error -1 is returned, on success the position of the
- * cursor. */
-inline int getCursorPosition(int ifd, int ofd) {
-    char buf[32];
-    int cols, rows;
-    unsigned int i = 0;
+/* What the terminal answered to ProbeTerminal(). */
+struct TerminalInfo {
+    TerminalInfo() : answered(false), cursor_row(0), cursor_col(0), columns(0),
+                     synchronized_output(false), bracketed_paste(false) {}
+    bool answered;                  /* It replied before the deadline. */
+    int cursor_row;                 /* Cursor position when probed, from 1, */
+    int cursor_col;                 /* 0 when unknown. */
+    int columns;                    /* Width, 0 when unknown. */
+    std::string device_attributes;  /* Primary DA parameters, e.g. "?62;22". */
+    bool synchronized_output;       /* DEC mode 2026 is known. */
+    bool bracketed_paste;           /* DEC mode 2004 is known. */
+};
+
+/* A descriptor that becomes readable when the terminal is resized, so an
+ * editor waiting for keys can redraw its line at the new width. The
+ * SIGWINCH handler is installed once, on the first Start(), and calls the
+ * one the program had installed before. */
+class ResizeWatcher {
+public:
+    ResizeWatcher() : slot(-1) { wake[0] = wake[1] = -1; }
+
+    /* The pipe is closed only once no SIGWINCH handler can still write
+     * to it: the signal is blocked on this thread, and handlers running on
+     * others after they read the slot are waited for. Otherwise one could
+     * write a byte into whatever the descriptor is reused for. */
+    ~ResizeWatcher() {
+#ifndef _WIN32
+        if (wake[0] == -1) return;
+        sigset_t winch, previous;
+        sigemptyset(&winch);
+        sigaddset(&winch, SIGWINCH);
+        pthread_sigmask(SIG_BLOCK, &winch, &previous);
+        if (slot != -1) {
+            resize_pipes[slot].store(0);
+            while (resize_handlers_running.load() > 0) std::this_thread::yield();
+        }
+        close(wake[0]);
+        close(wake[1]);
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+#endif
+    }
 
-    /* Report cursor location */
-    if (write(ofd, "\x1b[6n", 4) != 4) return -1;
+    ResizeWatcher(const ResizeWatcher&) = delete;
+    ResizeWatcher& operator=(const ResizeWatcher&) = delete;
 
-    /* Read the response: ESC [ rows ; cols R */
-    while (i < sizeof(buf)-1) {
-        if (read(ifd,buf+i,1) != 1) break;
-        if (buf[i] == 'R') break;
-        i++;
+    /* Watch from now on. Without a free slot the descriptor stays -1 and
+     * sizes are still asked again after a resize, at the next line. */
+    void Start() {
+#ifndef _WIN32
+        if (wake[0] != -1) return;
+        if (pipe(wake) == -1) {
+            wake[0] = wake[1] = -1;
+            return;
+        }
+        for (int i = 0; i < 2; i++) {
+            fcntl(wake[i], F_SETFL, fcntl(wake[i], F_GETFL) | O_NONBLOCK);
+            fcntl(wake[i], F_SETFD, FD_CLOEXEC);
+        }
+        for (int i = 0; i < LINENOISE_MAX_RESIZE_WATCHERS && slot == -1; i++) {
+            int free_slot = 0;
+            if (resize_pipes[i].compare_exchange_strong(free_slot, wake[1] + 1)) slot = i;
+        }
+        if (!resize_handler_installed.exchange(true)) {
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sigemptyset(&sa.sa_mask);
+            sa.sa_flags = SA_RESTART | SA_SIGINFO;
+            sa.sa_sigaction = linenoiseResizeHandler;
+            sigaction(SIGWINCH, &sa, &resize_previous_action);
+        }
+#endif
     }
-    buf[i] = '\0';
 
-    /* Parse it. */
-    if (buf[0] != ESC || buf[1] != '[') return -1;
-    if (sscanf(buf+2,"%d;%d",&rows,&cols) != 2) return -1;
-    return cols;
-}
+    /* Read end of the pipe, or -1 when not watching. */
+    int Fd() const { return slot == -1 ? -1 : wake[0]; }
 
-/* Try to get the number of columns in the current terminal, or assume 80
- * if it fails. */
-inline int getColumns(int ifd, int ofd) {
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO b;
+    void Clear() {
+#ifndef _WIN32
+        char drain[64];
+        while (read(wake[0], drain, sizeof(drain)) > 0) {}
+#endif
+    }
 
-    if (!GetConsoleScreenBufferInfo(hOut, &b)) return 80;
-    return b.srWindow.Right - b.srWindow.Left;
+    /* Changes after each resize. */
+    static unsigned Generation() {
+#ifndef _WIN32
+        return resize_generation.load();
 #else
-    struct winsize ws;
-
-    if (ioctl(1, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-        /* ioctl() failed. Try to query the terminal itself. */
-        int start, cols;
-
-        /* Get the initial position so we can restore it later. */
-        start = getCursorPosition(ifd,ofd);
-        if (start == -1) goto failed;
-
-        /* Go to right margin and get position. */
-        if (write(ofd,"\x1b[999C",6) != 6) goto failed;
-        cols = getCursorPosition(ifd,ofd);
-        if (cols == -1) goto failed;
-
-        /* Restore position. */
-        if (cols > start) {
-            char seq[32];
-            snprintf(seq,32,"\x1b[%dD",cols-start);
-            if (write(ofd,seq,strlen(seq)) == -1) {
-                /* Can't recover... */
-            }
-        }
-        return cols;
-    } else {
-        return ws.ws_col;
+        return 0;
+#endif
     }
 
-failed:
-    return 80;
-#endif
+private:
+    int wake[2];
+    int slot;
+};
+
+/* ========================== Terminals in raw mode ========================= */
+
+#ifndef _WIN32
+#define LINENOISE_MAX_RAW_TERMINALS 64
+
+/* A terminal an editor put in raw mode, with both of its modes so that
+ * the signal handlers and the atexit() handler can switch between them
+ * without touching the editor. */
+struct RawTerminal {
+    int fd;
+    struct termios cooked;
+    struct termios raw;
+};
+
+static std::atomic<RawTerminal*> raw_terminals[LINENOISE_MAX_RAW_TERMINALS];
+static std::atomic<bool> raw_session_handlers_installed(false);
+static struct sigaction raw_session_previous_tstp;
+static struct sigaction raw_session_previous_cont;
+
+/* Put every terminal in raw mode back in its cooked mode, or raw again,
+ * from a signal handler or at exit. */
+inline void linenoiseSetRawTerminals(bool cooked) {
+    for (int i = 0; i < LINENOISE_MAX_RAW_TERMINALS; i++) {
+        RawTerminal *t = raw_terminals[i].load();
+        if (t) tcsetattr(t->fd, TCSADRAIN, cooked ? &t->cooked : &t->raw);
+    }
 }
 
-/* Clear the screen. Used to handle ctrl+l */
-inline void linenoiseClearScreen(void) {
-    if (write(STDOUT_FILENO,"\x1b[H\x1b[2J",7) <= 0) {
-        /* nothing to do, just to avoid warning. */
+/* Suspended: give the shell back a cooked terminal, then stop as the
+ * default action would, unless the program handles the signal itself. */
+inline void linenoiseSuspendHandler(int sig, siginfo_t *info, void *context) {
+    int saved_errno = errno;
+    linenoiseSetRawTerminals(true);
+    if (!linenoiseChainSignal(raw_session_previous_tstp, sig, info, context) &&
+        raw_session_previous_tstp.sa_handler == SIG_DFL) {
+        struct sigaction dfl, ours;
+        sigset_t tstp;
+        memset(&dfl, 0, sizeof(dfl));
+        dfl.sa_handler = SIG_DFL;
+        sigemptyset(&dfl.sa_mask);
+        sigemptyset(&tstp);
+        sigaddset(&tstp, SIGTSTP);
+        sigaction(SIGTSTP, &dfl, &ours);
+        sigprocmask(SIG_UNBLOCK, &tstp, NULL);
+        raise(SIGTSTP); /* Stopped here until SIGCONT. */
+        sigaction(SIGTSTP, &ours, NULL);
     }
+    errno = saved_errno;
 }
 
-/* Beep, used for completion when there is nothing to complete or when all
- * the choices were already shown. */
-inline void linenoiseBeep(void) {
-    fprintf(stderr, "\x7");
-    fflush(stderr);
+/* Continued: raw again, as the line may still be edited. */
+inline void linenoiseContinueHandler(int sig, siginfo_t *info, void *context) {
+    int saved_errno = errno;
+    linenoiseSetRawTerminals(false);
+    linenoiseChainSignal(raw_session_previous_cont, sig, info, context);
+    errno = saved_errno;
 }
 
-/* ============================== Completion ================================ */
+/* Installed once the first editor keeps its terminal raw between lines,
+ * where Ctrl-Z no longer stops the program. */
+inline void linenoiseInstallSessionHandlers() {
+    if (raw_session_handlers_installed.exchange(true)) return;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sa.sa_sigaction = linenoiseSuspendHandler;
+    sigaction(SIGTSTP, &sa, &raw_session_previous_tstp);
+    sa.sa_sigaction = linenoiseContinueHandler;
+    sigaction(SIGCONT, &sa, &raw_session_previous_cont);
+}
 
-/* This is an helper function for linenoiseEdit() and is called when the
- * user types the <tab> key in order to complete the string currently in the
- * input.
- *
- * The state of the editing is encapsulated into the pointed linenoiseState
- * structure as described in the structure definition. */
-inline int completeLine(struct linenoiseState *ls, char *cbuf, int *c) {
-    std::vector<std::string> lc;
-    int nread = 0, nwritten;
-    *c = 0;
-
-    completionCallback(ls->buf,lc);
-    if (lc.empty()) {
-        linenoiseBeep();
-    } else {
-        int stop = 0, i = 0;
-
-        while(!stop) {
-            /* Show completion or original buffer */
-            if (i < static_cast<int>(lc.size())) {
-                struct linenoiseState saved = *ls;
-
-                ls->len = ls->pos = static_cast<int>(lc[i].size());
-                ls->buf = &lc[i][0];
-                refreshLine(ls);
-                ls->len = saved.len;
-                ls->pos = saved.pos;
-                ls->buf = saved.buf;
-            } else {
-                refreshLine(ls);
-            }
+inline void linenoiseAddRawTerminal(RawTerminal *t) {
+    for (int i = 0; i < LINENOISE_MAX_RAW_TERMINALS; i++) {
+        RawTerminal *free_slot = NULL;
+        if (raw_terminals[i].compare_exchange_strong(free_slot, t)) break;
+    }
+}
 
-            //nread = read(ls->ifd,&c,1);
-#ifdef _WIN32
-            nread = win32read(c);
-            if (nread == 1) {
-                cbuf[0] = *c;
-            }
-#else
-            nread = unicodeReadUTF8Char(ls->ifd,cbuf,c);
+inline void linenoiseRemoveRawTerminal(RawTerminal *t) {
+    for (int i = 0; i < LINENOISE_MAX_RAW_TERMINALS; i++) {
+        RawTerminal *slot = t;
+        raw_terminals[i].compare_exchange_strong(slot, NULL);
+    }
+}
 #endif
-            if (nread <= 0) {
-                *c = -1;
-                return nread;
-            }
 
-            switch(*c) {
-                case 9: /* tab */
-                    i = (i+1) % (lc.size()+1);
-                    if (i == static_cast<int>(lc.size())) linenoiseBeep();
-                    break;
-                case 27: /* escape */
-                    /* Re-show original buffer */
-                    if (i < static_cast<int>(lc.size())) refreshLine(ls);
-                    stop = 1;
-                    break;
-                default:
-                    /* Update buffer and return */
-                    if (i < static_cast<int>(lc.size())) {
-                        nwritten = snprintf(ls->buf,ls->buflen,"%s",&lc[i][0]);
-                        ls->len = ls->pos = nwritten;
-                    }
-                    stop = 1;
-                    break;
+/* =============================== Plain input ============================== */
+
+#define LINENOISE_READ_BUFFER (1 << 18) /* Bytes read at once from pipes. */
+#define LINENOISE_READ_LINES_MAX 1024   /* Default lines per ReadLines(). */
+
+/* Splits what a file, pipe or socket holds into lines, for input that is
+ * not a terminal. Regular files are mapped with mmap(), anything else is
+ * read in large blocks; line ends are found with memchr(). The input is
+ * read ahead, so other readers of the descriptor miss what it buffered,
+ * except for a mapped file, whose offset is set after the lines taken
+ * when the reader is destroyed. A mapped file is mapped again when its
+ * lines run out if it grew meanwhile, but it must not be truncated while
+ * read: touching the pages past its new end raises SIGBUS. */
+class LineReader {
+public:
+    explicit LineReader(int input_fd) : fd(input_fd), map(NULL), start(0), scan(0), end(0), eof(false) {
+#ifndef _WIN32
+        struct stat st;
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (offset >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > offset) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                map = static_cast<const char*>(p);
+                start = scan = offset;
+                end = st.st_size;
             }
         }
+#endif
+        if (!map) buffer.resize(LINENOISE_READ_BUFFER);
+    }
+
+    ~LineReader() {
+#ifndef _WIN32
+        if (map) {
+            lseek(fd, start, SEEK_SET);
+            munmap(const_cast<char*>(map), end);
+        }
+#endif
+    }
+
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    /* The next line, without its newline, valid until the next call.
+     * Returns false at the end of the input. */
+    bool Next(StringView& line) {
+        return take(line, true);
+    }
+
+    /* Up to 'max_lines' lines at once into 'lines', waiting only for the
+     * first: the others are those already read. They are valid until the
+     * next call. Returns their number, 0 at the end of the input. */
+    size_t ReadLines(std::vector<StringView>& lines, size_t max_lines) {
+        lines.clear();
+        StringView line;
+        if (max_lines == 0 || !take(line, true)) return 0;
+        do {
+            lines.push_back(line);
+        } while (lines.size() < max_lines && take(line, false));
+        return lines.size();
+    }
+
+private:
+    const char *data() const { return map ? map : buffer.data(); }
+
+    /* Cut the next line, reading more input when 'more' allows it, which
+     * moves the lines returned before. */
+    bool take(StringView& line, bool more) {
+        while (1) {
+            const char *base = data();
+            const char *nl = static_cast<const char*>(memchr(base + scan, '\n', end - scan));
+            if (nl) {
+                line = StringView(base + start, nl - (base + start));
+                start = scan = nl - base + 1;
+                return true;
+            }
+            scan = end;
+            if (!more || !fill()) break;
+        }
+        if (!more || start == end || !eof) return false;
+        /* The last line has no newline. */
+        line = StringView(data() + start, end - start);
+        start = scan = end;
+        return true;
+    }
+
+    /* Read a block after what is left of the buffer, growing it for lines
+     * longer than it. Returns false at the end of the input. */
+    bool fill() {
+        if (eof) return false;
+        if (map) return remap();
+        if (start > 0) {
+            memmove(&buffer[0], &buffer[start], end - start);
+            end -= start;
+            scan -= start;
+            start = 0;
+        }
+        if (end == buffer.size()) buffer.resize(buffer.size() * 2);
+        while (1) {
+#ifndef _WIN32
+            ssize_t nread = read(fd, &buffer[end], buffer.size() - end);
+#else
+            int nread = read(fd, &buffer[end], static_cast<unsigned>(buffer.size() - end));
+#endif
+            if (nread > 0) {
+                end += nread;
+                return true;
+            }
+#ifndef _WIN32
+            if (nread == -1 && errno == EINTR) continue;
+            if (nread == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                if (poll(&pfd, 1, -1) != -1 || errno == EINTR) continue;
+            }
+#endif
+            eof = true;
+            return false;
+        }
+    }
+
+    /* Map the file again if it grew since it was mapped. Returns false at
+     * the end of the input. */
+    bool remap() {
+#ifndef _WIN32
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > end) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, st.st_size, MADV_SEQUENTIAL);
+                munmap(const_cast<char*>(map), end);
+                map = static_cast<const char*>(p);
+                end = st.st_size;
+                return true;
+            }
+        }
+#endif
+        eof = true;
+        return false;
+    }
+
+    int fd;
+    const char *map;           /* The mapped file, or NULL. */
+    std::vector<char> buffer;  /* Otherwise, what was read. */
+    size_t start;              /* Start of the next line, */
+    size_t scan;               /* where to look for its end, */
+    size_t end;                /* and end of the input read. */
+    bool eof;
+};
+
+/* ================================= Keymap ================================= */
+
+/* Editing actions keys are bound to. */
+enum EditAction {
+    ACTION_NONE,                 /* The key is ignored. */
+    ACTION_SELF_INSERT,
+    ACTION_ACCEPT_LINE,
+    ACTION_INTERRUPT,
+    ACTION_DELETE_CHAR_OR_EOF,
+    ACTION_DELETE_CHAR,
+    ACTION_BACKWARD_DELETE_CHAR,
+    ACTION_TRANSPOSE_CHARS,
+    ACTION_BACKWARD_CHAR,
+    ACTION_FORWARD_CHAR,
+    ACTION_BACKWARD_WORD,
+    ACTION_FORWARD_WORD,
+    ACTION_BEGINNING_OF_LINE,
+    ACTION_END_OF_LINE,
+    ACTION_PREVIOUS_HISTORY,
+    ACTION_NEXT_HISTORY,
+    ACTION_KILL_WHOLE_LINE,
+    ACTION_KILL_LINE,
+    ACTION_KILL_WORD,
+    ACTION_UNIX_WORD_RUBOUT,
+    ACTION_CLEAR_SCREEN,
+    ACTION_COMPLETE,
+    ACTION_USER                  /* The first action added by the application. */
+};
+
+/* Names of the actions in keymap configurations, as readline's. */
+static const char *linenoiseActionNames[] = {
+    "none", "self-insert", "accept-line", "interrupt", "delete-char-or-eof",
+    "delete-char", "backward-delete-char", "transpose-chars", "backward-char",
+    "forward-char", "backward-word", "forward-word", "beginning-of-line",
+    "end-of-line", "previous-history", "next-history", "kill-whole-line",
+    "kill-line", "kill-word", "unix-word-rubout", "clear-screen", "complete",
+};
+
+/* An application action: may change the line and the cursor position,
+ * and returns true to accept the line as Enter does. */
+typedef std::function<bool (std::string& line, size_t& pos)> KeyCallback;
+
+/* Key bindings: the action of every ASCII and special key, under every
+ * combination of modifiers, at the index linenoiseKeyIndex() gives. Other
+ * keys insert themselves when unmodified. */
+struct Keymap {
+    static const int ROW = 128 + (F12_KEY - UNKNOWN_KEY); /* Keys per modifier combination. */
+    static const int SIZE = 8 * ROW;
+
+    uint16_t actions[SIZE];
+    std::vector<std::pair<std::string, KeyCallback>> user; /* From ACTION_USER on. */
+};
+
+/* Index of 'key' in a keymap, or -1 if it has none. */
+inline int linenoiseKeyIndex(int key) {
+    int base = key & (MOD_SHIFT - 1);
+    int mods = (key >> 24) & 7;
+    if (base < 128) return mods * Keymap::ROW + base;
+    if (base > UNKNOWN_KEY && base <= F12_KEY) return mods * Keymap::ROW + 128 + (base - UNKNOWN_KEY - 1);
+    return -1;
+}
+
+/* The emacs bindings of readline, and those of the original linenoise. */
+static const struct {
+    int key;
+    uint16_t action;
+} linenoiseEmacsBindings[] = {
+    {CTRL_A, ACTION_BEGINNING_OF_LINE},     {CTRL_B, ACTION_BACKWARD_CHAR},
+    {CTRL_C, ACTION_INTERRUPT},             {CTRL_D, ACTION_DELETE_CHAR_OR_EOF},
+    {CTRL_E, ACTION_END_OF_LINE},           {CTRL_F, ACTION_FORWARD_CHAR},
+    {CTRL_H, ACTION_BACKWARD_DELETE_CHAR},  {TAB, ACTION_COMPLETE},
+    {'\n', ACTION_ACCEPT_LINE},             {CTRL_K, ACTION_KILL_LINE},
+    {CTRL_L, ACTION_CLEAR_SCREEN},          {ENTER, ACTION_ACCEPT_LINE},
+    {CTRL_N, ACTION_NEXT_HISTORY},          {CTRL_P, ACTION_PREVIOUS_HISTORY},
+    {CTRL_T, ACTION_TRANSPOSE_CHARS},       {CTRL_U, ACTION_KILL_WHOLE_LINE},
+    {CTRL_W, ACTION_UNIX_WORD_RUBOUT},      {BACKSPACE, ACTION_BACKWARD_DELETE_CHAR},
+    {ARROW_UP, ACTION_PREVIOUS_HISTORY},    {ARROW_DOWN, ACTION_NEXT_HISTORY},
+    {ARROW_RIGHT, ACTION_FORWARD_CHAR},     {ARROW_LEFT, ACTION_BACKWARD_CHAR},
+    {HOME_KEY, ACTION_BEGINNING_OF_LINE},   {END_KEY, ACTION_END_OF_LINE},
+    {DEL_KEY, ACTION_DELETE_CHAR},
+    {'b' | MOD_ALT, ACTION_BACKWARD_WORD},  {'f' | MOD_ALT, ACTION_FORWARD_WORD},
+    {'d' | MOD_ALT, ACTION_KILL_WORD},      {static_cast<int>(BACKSPACE) | MOD_ALT, ACTION_UNIX_WORD_RUBOUT},
+    {ARROW_LEFT | MOD_CTRL, ACTION_BACKWARD_WORD}, {ARROW_RIGHT | MOD_CTRL, ACTION_FORWARD_WORD},
+    {ARROW_LEFT | MOD_ALT, ACTION_BACKWARD_WORD},  {ARROW_RIGHT | MOD_ALT, ACTION_FORWARD_WORD},
+};
+
+/* The keymap editors start with, built once and shared. */
+inline std::shared_ptr<const Keymap> DefaultKeymap() {
+    static std::shared_ptr<const Keymap> keymap([]() {
+        Keymap *k = new Keymap();
+        for (int i = 0; i < Keymap::SIZE; i++) {
+            int c = i % Keymap::ROW;
+            k->actions[i] = i < Keymap::ROW && c >= 32 && c < 127 ? ACTION_SELF_INSERT : ACTION_NONE;
+        }
+        for (const auto& b: linenoiseEmacsBindings) k->actions[linenoiseKeyIndex(b.key)] = b.action;
+        return k;
+    }());
+    return keymap;
+}
+
+/* Key names of keymap configurations: a character, or a name below, after
+ * any of the prefixes C- (control), M- or A- (alt) and S- (shift). */
+static const struct {
+    const char *name;
+    int key;
+} linenoiseKeyNames[] = {
+    {"Up", ARROW_UP}, {"Down", ARROW_DOWN}, {"Right", ARROW_RIGHT}, {"Left", ARROW_LEFT},
+    {"Home", HOME_KEY}, {"End", END_KEY}, {"Insert", INSERT_KEY}, {"Delete", DEL_KEY},
+    {"PageUp", PAGE_UP}, {"PageDown", PAGE_DOWN}, {"Tab", TAB}, {"Enter", ENTER},
+    {"Return", ENTER}, {"Escape", ESC}, {"Esc", ESC}, {"Backspace", BACKSPACE},
+    {"Space", ' '},
+};
+
+/* The key named 'name', or -1. */
+inline int linenoiseParseKey(StringView name) {
+    int mods = 0;
+    bool ctrl = false;
+    while (name.size() > 2 && name[1] == '-') {
+        if (name[0] == 'C') ctrl = true;
+        else if (name[0] == 'M' || name[0] == 'A') mods |= MOD_ALT;
+        else if (name[0] == 'S') mods |= MOD_SHIFT;
+        else break;
+        name = name.substr(2);
+    }
+    int key = -1;
+    for (const auto& k: linenoiseKeyNames) {
+        if (name == StringView(k.name)) key = k.key;
+    }
+    if (key == -1 && name.size() >= 2 && name.size() <= 3 && name[0] == 'F') {
+        /* F1 to F12. */
+        int n = 0;
+        for (size_t i = 1; i < name.size() && n >= 0; i++) {
+            n = isdigit((unsigned char)name[i]) ? n * 10 + (name[i] - '0') : -1;
+        }
+        if (n >= 1 && n <= 12) key = F1_KEY + n - 1;
+    }
+    if (key == -1 && !name.empty()) {
+        int n = unicodeUTF8CharToCodePoint(name.data(), static_cast<int>(name.size()), &key);
+        if (n == 0 || n != static_cast<int>(name.size())) return -1;
+    }
+    if (key == -1) return -1;
+    if (ctrl) {
+        /* C-a is the control character, C-Left a modified key. */
+        if (key >= '@' && key <= '~' && key != '`') key = toupper(key) & 0x1F;
+        else if (key == '?') key = BACKSPACE;
+        else mods |= MOD_CTRL;
+    }
+    return key | mods;
+}
+
+/* ================================= Editor ================================= */
+
+/* What EditFeed() reports. */
+enum EditStatus {
+    EDIT_MORE,  /* The line is still being edited. */
+    EDIT_LINE,  /* A line was entered. */
+    EDIT_EOF    /* Ctrl-C, Ctrl-D on an empty line or an error. */
+};
+
+#ifdef LINENOISE_COROUTINES
+/* How AsyncReadline() waits for input without blocking a thread: call
+ * 'resume' once one of 'fds' is readable or after 'timeout_ms' (-1 for no
+ * timeout), from the executor the coroutine runs on, e.g. by registering
+ * the descriptors with its epoll or io_uring loop. */
+typedef std::function<void (const std::vector<int>& fds, int timeout_ms, std::function<void()> resume)> InputWaiter;
+
+class ReadlineAwaiter;
+#endif
+
+/* A computed hint, as returned by the hints callback. */
+struct Hint {
+    std::string text;
+    int color;
+    int bold;
+};
+
+/* A line editor: its configuration, callbacks, history, terminal
+ * descriptors and state. Separate editors may run concurrently on
+ * different threads and terminals. The free functions of this namespace
+ * use the one returned by DefaultEditor(), on stdin and stdout. */
+class Editor {
+public:
+    explicit Editor(int stdin_fd = STDIN_FILENO, int stdout_fd = STDOUT_FILENO)
+        : completion_rank_max(0), prefetch_idle_ms(0), completion_cache_valid(false),
+          completion_cache_pos(0), hints_budget_ms(LINENOISE_DEFAULT_HINTS_BUDGET_MS),
+          ifd(stdin_fd), ofd(stdout_fd), rawmode(false), raw_session_mode(false), mlmode(false), hsmode(false),
+          asmode(false), history_max_len(LINENOISE_DEFAULT_HISTORY_MAX_LEN), history_base(0),
+          history_index(HistoryOrder(this)), term_cols(0), term_rows(0), size_cols(80), size_rows(24), size_generation(0),
+          size_known(false), terminal_probed(false), plain_input(false), escape_timeout_ms(LINENOISE_DEFAULT_ESCAPE_TIMEOUT_MS),
+          input_start(0), input_end(0), input_waiting(false), keymap(DefaultKeymap()), edit_active(false), edit_done(false), edit_hidden(false), output(stdout_fd) {}
+    ~Editor() {
+        EditStop();
+        disableRawMode(ifd);
+    }
+    Editor(const Editor&) = delete;
+    Editor& operator=(const Editor&) = delete;
+
+    void SetMultiLine(bool ml);
+    void SetRawSession(bool enable);
+    void SetHistoryPrefixSearch(bool hs);
+    void SetHistorySuggestions(bool as);
+    void SetHintsCallback(HintsCallback fn);
+    void SetHintsTimeBudget(int ms);
+    void SetHighlightCallback(HighlightCallback fn);
+    void SetCompletionPrefetch(int idle_ms);
+    void SetCompletionMenuCallback(CompletionMenuCallback fn);
+    void SetCompletionRanking(CompletionScoreCallback score, size_t k);
+    void SetCompletionCallback(CompletionCallback fn);
+    void SetAsyncCompletionCallback(AsyncCompletionCallback fn);
+    void SetCompletionRangeCallback(CompletionRangeCallback fn);
+    bool Readline(const char *prompt, StringView& line);
+    bool Readline(const char *prompt, std::string& line);
+    std::string Readline(const char *prompt, bool& quit);
+    std::string Readline(const char *prompt);
+    size_t ReadLines(std::vector<StringView>& lines, size_t max_lines = LINENOISE_READ_LINES_MAX);
+    void EditStop();
+    bool EditStart(const char *prompt);
+    EditStatus EditFeed(std::string& line);
+    void EditPollFds(std::vector<int>& fds);
+    int EditTimeout();
+    void EditHide();
+    void EditShow();
+    bool WriteOutput(StringView text);
+    bool FlushOutput();
+    size_t PendingOutput() const;
+    void SetTerminalSize(int cols, int rows);
+    void SetEscapeTimeout(int ms);
+    const TerminalInfo& ProbeTerminal(int timeout_ms = LINENOISE_DEFAULT_PROBE_TIMEOUT_MS);
+    bool BindKey(int key, EditAction action);
+    bool BindKey(int key, KeyCallback fn);
+    int AddKeyAction(const char *name, KeyCallback fn);
+    bool LoadKeymap(const char *config);
+    void ResetKeymap();
+#ifdef LINENOISE_COROUTINES
+    ReadlineAwaiter AsyncReadline(const char *prompt, InputWaiter waiter);
+#endif
+    bool AddHistory(const char* line);
+    bool SetHistoryMaxLen(size_t len);
+    bool SaveHistory(const char* path);
+    bool LoadHistory(const char* path);
+    const std::vector<std::string>& GetHistory();
+
+private:
+    /* Orders sequence numbers of 'history' by their line, then by age. The
+     * number ULONG_MAX stands for 'history_probe', before the equal lines. */
+    struct HistoryOrder {
+        explicit HistoryOrder(const Editor *e) : editor(e) {}
+        bool operator()(unsigned long a, unsigned long b) const {
+            int c = editor->historyLine(a).compare(editor->historyLine(b));
+            if (c != 0) return c < 0;
+            return a != b && (a == ULONG_MAX || (b != ULONG_MAX && a < b));
+        }
+        const Editor *editor;
+    };
+    typedef std::set<unsigned long, HistoryOrder> HistoryIndex;
+
+    bool enableRawMode(int fd);
+    void disableRawMode(int fd);
+    void linenoiseUpdateHint(struct linenoiseState *l);
+    void linenoiseEditChanged(struct linenoiseState *l, int start, int removed, int inserted);
+    void linenoiseUpdateHighlight(struct linenoiseState *l);
+    int linenoiseEditReplace(struct linenoiseState *l, int start, int removed, const char *text, int tlen);
+    void completeLineShow(struct linenoiseState *ls, int i);
+    void completeLineCycle(struct linenoiseState *ls);
+    bool completeLineCycleKey(struct linenoiseState *ls, int c, int action);
+    void linenoiseCollectCompletions(struct linenoiseState *ls);
+    void linenoiseCacheCompletions(StringView buffer, size_t pos);
+    bool linenoiseNarrowCompletions(struct linenoiseState *ls);
+    void completeLine(struct linenoiseState *ls);
+    std::shared_ptr<CompletionRequest> linenoiseStartCompletion(struct linenoiseState *ls);
+    bool linenoiseCompletionMatches(struct linenoiseState *ls, const CompletionRequest& req);
+    void linenoiseRequestCompletion(struct linenoiseState *ls);
+    int linenoisePrefetchTimeout(struct linenoiseState *ls);
+    void linenoiseStartPrefetch(struct linenoiseState *ls);
+    bool linenoiseTakePrefetch(struct linenoiseState *ls);
+    bool linenoiseTakeCompletion(struct linenoiseState *ls);
+    bool completeLineMenuPull(struct linenoiseState *ls, std::string& out);
+    void completeLineMenuPage(struct linenoiseState *ls, std::vector<std::string> page);
+    void completeLineMenu(struct linenoiseState *ls);
+    void completeLineMenuKey(struct linenoiseState *ls, int c, int action);
+    void linenoiseUpdateSuggestion(struct linenoiseState *l);
+    void refreshLine(struct linenoiseState *l);
+    int linenoiseEditInsert(struct linenoiseState *l, const char* cbuf, int clen);
+    bool linenoiseEditAcceptSuggestion(struct linenoiseState *l);
+    void linenoiseEditHideSuggestion(struct linenoiseState *l);
+    void linenoiseEditMoveLeft(struct linenoiseState *l);
+    void linenoiseEditMoveRight(struct linenoiseState *l);
+    void linenoiseEditMoveHome(struct linenoiseState *l);
+    void linenoiseEditMoveEnd(struct linenoiseState *l);
+    void linenoiseEditHistorySearch(struct linenoiseState *l, int dir);
+    void linenoiseEditHistoryNext(struct linenoiseState *l, int dir);
+    void linenoiseEditDelete(struct linenoiseState *l);
+    void linenoiseEditBackspace(struct linenoiseState *l);
+    void linenoiseEditDeletePrevWord(struct linenoiseState *l);
+    void linenoiseEditMoveWordLeft(struct linenoiseState *l);
+    void linenoiseEditMoveWordRight(struct linenoiseState *l);
+    void linenoiseEditDeleteNextWord(struct linenoiseState *l);
+    int linenoiseEditAccept(struct linenoiseState *l);
+    bool linenoiseEditUserAction(struct linenoiseState *l, int action);
+    int linenoiseKeyAction(int key);
+    int linenoiseInputTimeout();
+    int linenoiseReadKey(struct linenoiseState *l, int *key, char *bytes);
+    void linenoiseProbeTerminal(int timeout_ms);
+    void linenoiseTerminalSize(int *cols, int *rows);
+    void linenoiseEditResize(struct linenoiseState *l);
+    int linenoiseEditPoll(struct linenoiseState *l, int timeout);
+    bool linenoiseWaitInput(struct linenoiseState *l);
+    int linenoiseEditStart(struct linenoiseState *l, int stdin_fd, int stdout_fd, char *buf, int buflen, const char *prompt);
+    int linenoiseEditFeed(struct linenoiseState *l);
+    int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, int buflen, const char *prompt);
+    void historyReplace(size_t i, const char *line);
+    void historyPopBack(void);
+    void historyPopFront(void);
+    StringView historyLine(unsigned long seq) const;
+    HistoryIndex::const_iterator historyLowerBound(StringView prefix);
+    bool historyShownMatch(unsigned long seq, StringView prefix, const std::string& skip);
+    bool linenoiseRaw(const char *prompt, StringView& line);
+    bool linenoiseReadPlainLine(StringView& line);
+
+    friend class ReadlineAwaiter;
+
+    CompletionCallback completionCallback;
+    CompletionRangeCallback completionRangeCallback;
+    AsyncCompletionCallback asyncCompletionCallback;
+    CompletionMenuCallback completionMenuCallback;
+    CompletionScoreCallback completionScoreCallback;
+    size_t completion_rank_max;
+    int prefetch_idle_ms;         /* Completion prefetch idle delay, 0 disables it. */
+    Completions completions;      /* Candidates of the last Tab. */
+    bool completion_cache_valid;  /* 'completions' may be narrowed */
+    std::string completion_cache_buffer; /* for the buffer they were */
+    size_t completion_cache_pos;  /* computed for. */
+    HintsCallback hintsCallback;
+    HighlightCallback highlightCallback;
+    int hints_budget_ms;
+
+    /* Hints already computed, per buffer content. Filled by hints_worker. */
+    std::mutex hints_mutex;
+    std::condition_variable hints_cond;
+    std::unordered_map<std::string, Hint> hints_cache;
+
+    int ifd;                      /* Terminal input. */
+    int ofd;                      /* Terminal output. */
+#ifndef _WIN32
+    struct termios orig_termios;  /* In order to restore at exit.*/
+#endif
+    bool rawmode;  /* For atexit() function to check if restore is needed*/
+    bool raw_session_mode;  /* Stay in raw mode between lines. */
+#ifndef _WIN32
+    RawTerminal raw_terminal; /* Registered while in raw mode. */
+#endif
+    bool mlmode;   /* Multi line mode. Default is single line. */
+    bool hsmode;   /* Prefix history search mode. Default is off. */
+    bool asmode;   /* History autosuggestions. Default is off. */
+    size_t history_max_len;
+    std::vector<std::string> history;
+    unsigned long history_base;   /* Sequence number of history[0]. */
+    /* Sequence numbers of 'history' sorted by line, so the entries that start
+     * with a given prefix are a contiguous range found in O(log n), without
+     * a second copy of the lines. */
+    HistoryIndex history_index;
+    StringView history_probe; /* Line looked up in 'history_index'. */
+    int term_cols;  /* Size set by SetTerminalSize(), */
+    int term_rows;  /* 0 to ask the terminal. */
+
+    /* Size the terminal last reported, asked again after a SIGWINCH. */
+    ResizeWatcher resize_watcher;
+    int size_cols;
+    int size_rows;
+    unsigned size_generation;
+    bool size_known;
+
+    /* Replies to the queries of ProbeTerminal(), which are sent once. */
+    TerminalInfo terminal_info;
+    bool terminal_probed;
+
+    /* Input that is not a terminal, or only read as lines. */
+    std::unique_ptr<LineReader> line_reader;
+    bool plain_input;  /* 'ifd' is not a terminal. */
+
+    /* Line edited by Readline(), allocated on first use. */
+    std::unique_ptr<char[]> line_buf;
+
+    /* Terminal input read but not handled yet, kept from a line to the
+     * next. When it ends with an unfinished sequence, the rest is waited
+     * for until 'input_deadline'. */
+    int escape_timeout_ms;
+    char input[LINENOISE_INPUT_BUFFER];
+    int input_start;
+    int input_end;
+    bool input_waiting;
+    std::chrono::steady_clock::time_point input_deadline;
+
+    /* Shared until changed, then copied: bindings are rarely changed. */
+    std::shared_ptr<const Keymap> keymap;
+
+    /* Line edited with EditStart() and EditFeed(). */
+    struct linenoiseState edit_state;
+    char edit_buf[LINENOISE_MAX_LINE];
+    bool edit_active;  /* Between EditStart() and EditStop(). */
+    bool edit_done;    /* EditFeed() reported the end of the line. */
+    bool edit_hidden;  /* EditHide() was called. */
+
+    TerminalOutput output;  /* On 'ofd'. */
+
+    /* Last, so that their threads stop before the rest is destroyed. */
+    BackgroundWorker hints_worker;
+    BackgroundWorker completion_worker;
+};
+
+/* The editor of the free functions, on stdin and stdout. */
+inline Editor& DefaultEditor() {
+    static Editor editor;
+    return editor;
+}
+
+/* ======================= Low level terminal handling ====================== */
+
+/* Set if to use or not the multi line mode. */
+inline void Editor::SetMultiLine(bool ml) {
+    mlmode = ml;
+}
+
+inline void SetMultiLine(bool ml) {
+    DefaultEditor().SetMultiLine(ml);
+}
+
+/* Keep the terminal in raw mode from a line to the next, rather than
+ * leaving it after each one, so the keys typed while the program handles
+ * a line are kept for the next one instead of being flushed or echoed.
+ * Meanwhile Ctrl-C and Ctrl-Z are such keys too, not signals. Cooked mode
+ * comes back on SIGTSTP, at exit, when the editor is destroyed or when
+ * the session is disabled. */
+inline void Editor::SetRawSession(bool enable) {
+#ifndef _WIN32
+    if (enable) linenoiseInstallSessionHandlers();
+#endif
+    if (!enable && rawmode && !edit_active) disableRawMode(ifd);
+    raw_session_mode = enable;
+}
+
+inline void SetRawSession(bool enable) {
+    DefaultEditor().SetRawSession(enable);
+}
+
+/* Set if Up/Down should only walk the history entries starting with the
+ * text before the cursor. */
+inline void Editor::SetHistoryPrefixSearch(bool hs) {
+    hsmode = hs;
+}
+
+inline void SetHistoryPrefixSearch(bool hs) {
+    DefaultEditor().SetHistoryPrefixSearch(hs);
+}
+
+/* Set if the newest history entry extending the buffer should be shown
+ * as grey text after the cursor, accepted with Right arrow or Ctrl-E. */
+inline void Editor::SetHistorySuggestions(bool as) {
+    asmode = as;
+}
+
+inline void SetHistorySuggestions(bool as) {
+    DefaultEditor().SetHistorySuggestions(as);
+}
+
+/* Return true if the terminal name is in the list of terminals we know are
+ * not able to understand basic escape sequences. */
+inline bool isUnsupportedTerm(void) {
+#ifndef _WIN32
+    char *term = getenv("TERM");
+    int j;
+
+    if (term == NULL) return false;
+    for (j = 0; unsupported_term[j]; j++)
+        if (!strcasecmp(term,unsupported_term[j])) return true;
+#endif
+    return false;
+}
+
+/* Raw mode: 1960 magic shit. */
+inline bool Editor::enableRawMode(int fd) {
+#ifndef _WIN32
+    struct termios raw;
+
+    if (rawmode) return true; /* Still raw from the last line of a session. */
+    if (!isatty(fd)) goto fatal;
+    if (!atexit_registered.exchange(true)) atexit(linenoiseAtExit);
+    if (tcgetattr(fd,&orig_termios) == -1) goto fatal;
+
+    raw = orig_termios;  /* modify the original mode */
+    /* input modes: no break, no CR to NL, no parity check, no strip char,
+     * no start/stop output control. */
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    /* output modes - disable post processing */
+    // NOTE: Multithreaded issue #20 (https://github.com/yhirose/cpp-linenoise/issues/20)
+    // raw.c_oflag &= ~(OPOST);
+    /* control modes - set 8 bit chars */
+    raw.c_cflag |= (CS8);
+    /* local modes - echoing off, canonical off, no extended functions,
+     * no signal chars (^Z,^C) */
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    /* control chars - set return condition: min number of bytes and timer.
+     * We want read to return every single byte, without timeout. */
+    raw.c_cc[VMIN] = 1; raw.c_cc[VTIME] = 0; /* 1 byte, no timer */
+
+    /* put terminal in raw mode after flushing, or keeping what was typed
+     * ahead in a session */
+    if (tcsetattr(fd,raw_session_mode ? TCSADRAIN : TCSAFLUSH,&raw) < 0) goto fatal;
+    rawmode = true;
+    raw_terminal.fd = fd;
+    raw_terminal.cooked = orig_termios;
+    raw_terminal.raw = raw;
+    linenoiseAddRawTerminal(&raw_terminal);
+#else
+    if (!atexit_registered.exchange(true)) {
+        /* Cleanup them at exit */
+        atexit(linenoiseAtExit);
+
+        /* Init windows console handles only once */
+        hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (hOut==INVALID_HANDLE_VALUE) goto fatal;
+    }
+
+    DWORD consolemodeOut;
+    if (!GetConsoleMode(hOut, &consolemodeOut)) {
+        CloseHandle(hOut);
+        errno = ENOTTY;
+        return false;
+    };
+
+    hIn = GetStdHandle(STD_INPUT_HANDLE);
+    if (hIn == INVALID_HANDLE_VALUE) {
+        CloseHandle(hOut);
+        errno = ENOTTY;
+        return false;
+    }
+
+    GetConsoleMode(hIn, &consolemodeIn);
+    /* Enable raw mode */
+    SetConsoleMode(hIn, consolemodeIn & ~ENABLE_PROCESSED_INPUT);
+
+    rawmode = true;
+#endif
+    return true;
+
+fatal:
+    errno = ENOTTY;
+    return false;
+}
+
+inline void Editor::disableRawMode(int fd) {
+#ifdef _WIN32
+    if (consolemodeIn) {
+      SetConsoleMode(hIn, consolemodeIn);
+      consolemodeIn = 0;
+    }
+    rawmode = false;
+#else
+    /* Don't even check the return value as it's too late. */
+    if (!rawmode) return;
+    linenoiseRemoveRawTerminal(&raw_terminal);
+    if (tcsetattr(fd,raw_session_mode ? TCSADRAIN : TCSAFLUSH,&orig_termios) != -1)
+        rawmode = false;
+#endif
+}
+
+/* Queries sent at once by ProbeTerminal(): DEC modes 2026 (synchronized
+ * output) and 2004 (bracketed paste), the cursor position, the position
+ * at the right margin, which gives the width, and the primary device
+ * attributes. Terminals answer in order and nearly all answer the last
+ * one, so its reply ends the probe. */
+static const char linenoise_probe_queries[] =
+    "\x1b[?2026$p\x1b[?2004$p\x1b[6n\x1b" "7\x1b[999C\x1b[6n\x1b" "8\x1b[c";
+
+/* Send the queries and take their replies out of the terminal input as
+ * they arrive, until the last one or for at most 'timeout_ms'. The keys
+ * typed meanwhile stay in the input for the line. */
+inline void Editor::linenoiseProbeTerminal(int timeout_ms) {
+#ifndef _WIN32
+    const ssize_t qlen = sizeof(linenoise_probe_queries) - 1;
+    if (write(ofd, linenoise_probe_queries, qlen) != qlen) return;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    if (input_start > 0) {
+        memmove(input, input + input_start, input_end - input_start);
+        input_end -= input_start;
+        input_start = 0;
+    }
+    int scan = input_end; /* What was read before holds no reply. */
+    int positions = 0;
+    bool done = false;
+    while (1) {
+        /* Take the complete replies read so far: ESC [ <params> <final>. */
+        while (scan < input_end && !done) {
+            if (input[scan] != ESC) {
+                scan++;
+                continue;
+            }
+            if (scan + 1 == input_end) break;
+            if (input[scan + 1] != '[') {
+                scan++;
+                continue;
+            }
+            int end = scan + 2;
+            while (end < input_end && end - scan < LINENOISE_MAX_SEQUENCE &&
+                   (input[end] < 0x40 || input[end] > 0x7E)) end++;
+            if (end == input_end) break;
+            if (end - scan == LINENOISE_MAX_SEQUENCE) {
+                scan++;
+                continue;
+            }
+            std::string params(input + scan + 2, end - scan - 2);
+            char final = input[end];
+            int len = end + 1 - scan;
+            int a, b;
+            if (final == 'R' && sscanf(params.c_str(), "%d;%d", &a, &b) == 2) {
+                if (positions++ == 0) {
+                    terminal_info.cursor_row = a;
+                    terminal_info.cursor_col = b;
+                } else {
+                    terminal_info.columns = b;
+                }
+            } else if (final == 'y' && sscanf(params.c_str(), "?%d;%d", &a, &b) == 2) {
+                /* 1 and 2: set and reset, 3: always set. */
+                bool known = b >= 1 && b <= 3;
+                if (a == 2026) terminal_info.synchronized_output = known;
+                if (a == 2004) terminal_info.bracketed_paste = known;
+            } else if (final == 'c' && params[0] == '?') {
+                terminal_info.device_attributes = params;
+                done = true;
+            } else {
+                scan += len; /* A key. */
+                continue;
+            }
+            terminal_info.answered = true;
+            memmove(input + scan, input + scan + len, input_end - scan - len);
+            input_end -= len;
+        }
+        if (done || input_end == LINENOISE_INPUT_BUFFER) break;
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) break;
+        struct pollfd fd;
+        fd.fd = ifd;
+        fd.events = POLLIN;
+        int n = poll(&fd, 1, static_cast<int>(left.count()));
+        if (n == -1 && errno == EINTR) continue;
+        if (n != 1) break;
+        ssize_t nread = read(ifd, input + input_end, LINENOISE_INPUT_BUFFER - input_end);
+        if (nread > 0) {
+            input_end += static_cast<int>(nread);
+        } else if (nread == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            break;
+        }
+    }
+#else
+    (void)timeout_ms;
+#endif
+}
+
+/* Size of the terminal: the one given to SetTerminalSize(), or the one
+ * the terminal reported, asked again only after it was resized. When
+ * ioctl() can not tell, the width ProbeTerminal() found is used, so the
+ * terminal is only queried once. */
+inline void Editor::linenoiseTerminalSize(int *cols, int *rows) {
+    if (term_cols > 0) {
+        *cols = term_cols;
+        *rows = term_rows > 0 ? term_rows : 24;
+        return;
+    }
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO b;
+
+    if (GetConsoleScreenBufferInfo(hOut, &b)) {
+        size_cols = b.srWindow.Right - b.srWindow.Left;
+        size_rows = b.srWindow.Bottom - b.srWindow.Top + 1;
+    }
+#else
+    unsigned generation = ResizeWatcher::Generation();
+    if (!size_known || generation != size_generation) {
+        struct winsize ws;
+
+        size_generation = generation;
+        if (ioctl(ofd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+            size_cols = ws.ws_col;
+            size_rows = ws.ws_row > 0 ? ws.ws_row : 24;
+        } else if (ProbeTerminal().columns > 0) {
+            size_cols = terminal_info.columns;
+        }
+        size_known = true;
+    }
+#endif
+    *cols = size_cols;
+    *rows = size_rows;
+}
+
+/* write() to 'out', or send() to a socket so that a peer that went away
+ * fails the write rather than raising SIGPIPE. */
+inline int linenoiseWriteSome(TerminalOutput *out, const char *buf, int len) {
+#ifdef MSG_NOSIGNAL
+    if (out->is_socket) return static_cast<int>(send(out->fd, buf, len, MSG_NOSIGNAL));
+#endif
+    return write(out->fd, buf, len);
+}
+
+/* Write what is queued for 'out' until it would block. Returns the number
+ * of bytes left, or -1 on errors. */
+inline long linenoiseFlush(TerminalOutput *out) {
+    std::string& queue = out->queue;
+    size_t done = 0;
+    while (done < queue.size()) {
+        int n = linenoiseWriteSome(out, queue.data() + done, static_cast<int>(queue.size() - done));
+        if (n > 0) {
+            done += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    queue.erase(0, done);
+    return static_cast<long>(queue.size());
+}
+
+/* Write 'len' bytes to 'out' after what is queued. A non-blocking
+ * descriptor may take only part of them: the rest is queued, to be written
+ * once it is writable again. Returns -1 on errors. */
+inline int linenoiseWrite(TerminalOutput *out, const char *buf, int len) {
+    if (!out->queue.empty()) {
+        out->queue.append(buf, len);
+        return linenoiseFlush(out) == -1 ? -1 : len;
+    }
+    int done = 0;
+    while (done < len) {
+        int n = linenoiseWriteSome(out, buf + done, len - done);
+        if (n > 0) {
+            done += n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            out->queue.append(buf + done, len - done);
+            break;
+        } else {
+            return -1;
+        }
+    }
+    return len;
+}
+
+/* Clear the screen. Used to handle ctrl+l */
+inline void linenoiseClearScreen(struct linenoiseState *l) {
+    if (linenoiseWrite(l->output,"\x1b[H\x1b[2J",7) <= 0) {
+        /* nothing to do, just to avoid warning. */
+    }
+}
+
+/* Beep, used for completion when there is nothing to complete or when all
+ * the choices were already shown. */
+inline void linenoiseBeep(struct linenoiseState *l) {
+    if (linenoiseWrite(l->output,"\x7",1) == -1) {}
+}
+
+/* ================================= Hints ================================== */
+
+/* Register a callback returning the hint shown at the right of the buffer,
+ * or an empty string for none. 'color' (an ANSI color, -1 by default) and
+ * 'bold' (0 by default) may be set to style it. The callback runs on a
+ * background thread and its results are memoized per buffer content. */
+inline void Editor::SetHintsCallback(HintsCallback fn) {
+    std::lock_guard<std::mutex> lock(hints_mutex);
+    hintsCallback = fn;
+    hints_cache.clear();
+}
+
+inline void SetHintsCallback(HintsCallback fn) {
+    DefaultEditor().SetHintsCallback(fn);
+}
+
+/* Set how long a refresh waits for a hint not computed yet. When the
+ * callback takes longer the line is drawn without it and redrawn once the
+ * hint is ready. 0 never waits. */
+inline void Editor::SetHintsTimeBudget(int ms) {
+    hints_budget_ms = ms < 0 ? 0 : ms;
+}
+
+inline void SetHintsTimeBudget(int ms) {
+    DefaultEditor().SetHintsTimeBudget(ms);
+}
+
+/* Look up the hint for the current buffer, computing it on the worker and
+ * waiting at most the time budget if it is not memoized yet. */
+inline void Editor::linenoiseUpdateHint(struct linenoiseState *l) {
+    l->hint.clear();
+    l->hint_waiting = false;
+    if (!hintsCallback || !l->suggestion.empty()) return;
+
+    std::string key(l->buf, l->len);
+    std::unique_lock<std::mutex> lock(hints_mutex);
+    auto it = hints_cache.find(key);
+    if (it == hints_cache.end()) {
+        HintsCallback fn = hintsCallback;
+        bool busy = hints_worker.Busy();
+        hints_worker.Post([this, fn, key]() {
+            Hint h;
+            h.color = -1;
+            h.bold = 0;
+            h.text = fn(key.c_str(), h.color, h.bold);
+            {
+                std::lock_guard<std::mutex> guard(hints_mutex);
+                if (hints_cache.size() >= LINENOISE_HINTS_CACHE_MAX) hints_cache.clear();
+                hints_cache[key] = h;
+            }
+            hints_cond.notify_all();
+        });
+        /* Behind a slow hint of an older buffer, do not wait: the line is
+         * redrawn when the wake descriptor reports this one. */
+        if (!busy) {
+            hints_cond.wait_for(lock, std::chrono::milliseconds(hints_budget_ms), [&]() {
+                return (it = hints_cache.find(key)) != hints_cache.end();
+            });
+        }
+        if (it == hints_cache.end()) {
+            l->hint_waiting = true;
+            return;
+        }
+    }
+    l->hint = it->second.text;
+    l->hint_color = it->second.color;
+    l->hint_bold = it->second.bold;
+}
+
+/* ============================== Highlighting ============================== */
+
+/* Register a callback styling the edited buffer. It receives the buffer,
+ * the range [start, end) edited since its last call and the spans of that
+ * call: the ones outside the range are kept and moved along with the text,
+ * the ones the edit touched are removed and included in the range. So the
+ * callback only needs to add spans for the edited range, instead of
+ * tokenizing the whole line on every key. */
+inline void Editor::SetHighlightCallback(HighlightCallback fn) {
+    highlightCallback = fn;
+}
+
+inline void SetHighlightCallback(HighlightCallback fn) {
+    DefaultEditor().SetHighlightCallback(fn);
+}
+
+/* Record that 'removed' bytes at 'start' of the buffer were replaced with
+ * 'inserted' bytes, moving the highlight spans after the edit and growing
+ * the range to highlight again. */
+inline void Editor::linenoiseEditChanged(struct linenoiseState *l, int start, int removed, int inserted) {
+    int end = start + removed;
+    int delta = inserted - removed;
+    auto adjust = [&](int x) {
+        return x <= start ? x : (x >= end ? x + delta : start + inserted);
+    };
+    int dstart = start, dend = start + inserted;
+    if (l->hl_dirty_start >= 0) {
+        dstart = std::min(dstart, adjust(l->hl_dirty_start));
+        dend = std::max(dend, adjust(l->hl_dirty_end));
+    }
+    size_t j = 0;
+    for (size_t i = 0; i < l->hl_spans.size(); i++) {
+        HighlightSpan sp = l->hl_spans[i];
+        int a = sp.offset, b = sp.offset + sp.length;
+        if (b < start || a > end) {
+            sp.offset = adjust(a);
+            l->hl_spans[j++] = sp;
+        } else {
+            dstart = std::min(dstart, adjust(a));
+            dend = std::max(dend, adjust(b));
+        }
+    }
+    l->hl_spans.resize(j);
+    l->hl_dirty_start = dstart;
+    l->hl_dirty_end = dend;
+
+    /* Completions computed or being computed are for the old buffer. */
+    l->generation++;
+    if (l->completion_request) {
+        l->completion_request->token.Cancel();
+        l->completion_request.reset();
+    }
+    if (l->completion_prefetch) {
+        l->completion_prefetch->token.Cancel();
+        l->completion_prefetch.reset();
+    }
+}
+
+/* Let the highlight callback restyle the range edited since its last call,
+ * then keep the spans sorted, inside the buffer and not overlapping. */
+inline void Editor::linenoiseUpdateHighlight(struct linenoiseState *l) {
+    if (!highlightCallback) {
+        l->hl_spans.clear();
+        l->hl_dirty_start = -1;
+        return;
+    }
+    if (l->hl_dirty_start < 0) return;
+
+    int start = std::min(l->hl_dirty_start, l->len);
+    int end = std::min(l->hl_dirty_end, l->len);
+    l->hl_dirty_start = -1;
+    highlightCallback(l->buf, l->len, start, end, l->hl_spans);
+
+    std::vector<HighlightSpan>& spans = l->hl_spans;
+    auto byOffset = [](const HighlightSpan& a, const HighlightSpan& b) { return a.offset < b.offset; };
+    if (!std::is_sorted(spans.begin(), spans.end(), byOffset)) {
+        std::stable_sort(spans.begin(), spans.end(), byOffset);
+    }
+    size_t j = 0;
+    int covered = 0;
+    for (size_t i = 0; i < spans.size(); i++) {
+        HighlightSpan sp = spans[i];
+        int b = std::min(sp.offset + sp.length, l->len);
+        sp.offset = std::max(sp.offset, covered);
+        sp.length = b - sp.offset;
+        if (sp.length <= 0) continue;
+        covered = b;
+        spans[j++] = sp;
+    }
+    spans.resize(j);
+}
+
+/* ============================== Completion ================================ */
+
+/* Replace 'removed' bytes at 'start' of the buffer with 'text', as much of
+ * it as fits, leaving the cursor after it. Returns the bytes inserted. */
+inline int Editor::linenoiseEditReplace(struct linenoiseState *l, int start, int removed, const char *text, int tlen) {
+    tlen = std::min(tlen, l->buflen - (l->len - removed));
+    linenoiseEditChanged(l, start, removed, tlen);
+    memmove(l->buf+start+tlen,l->buf+start+removed,l->len-start-removed);
+    memcpy(l->buf+start,text,tlen);
+    l->len += tlen - removed;
+    l->buf[l->len] = '\0';
+    l->pos = start + tlen;
+    return tlen;
+}
+
+/* Show completion 'i' in the buffer in place of the one shown, or the
+ * original text again when 'i' is the number of completions. Every
+ * candidate replaces its own range of the buffer in place, so completing
+ * a word inside a long line only moves the text after it. */
+inline void Editor::completeLineShow(struct linenoiseState *ls, int i) {
+    if (ls->cycle_len >= 0) {
+        linenoiseEditReplace(ls, ls->cycle_start, ls->cycle_len, ls->cycle_replaced.data(), static_cast<int>(ls->cycle_replaced.size()));
+        ls->cycle_len = -1;
+    }
+    if (i < ls->cycle_size) {
+        int start = static_cast<int>(std::min(completions.Start(i), (size_t)ls->len));
+        int end = static_cast<int>(std::min(completions.End(i), (size_t)ls->len));
+        if (end < start) end = start;
+        StringView text = completions.Text(i);
+        ls->cycle_replaced.assign(ls->buf + start, end - start);
+        ls->cycle_start = start;
+        ls->cycle_len = linenoiseEditReplace(ls, start, end - start, text.data(), static_cast<int>(text.size()));
+    } else {
+        ls->pos = ls->cycle_pos;
+    }
+    ls->cycle_index = i;
+}
+
+/* This is an helper function for linenoiseEdit() and is called when the
+ * user types the <tab> key in order to complete the string currently in the
+ * input: it shows the first of 'completions', and the next Tab keys are
+ * handled by completeLineCycleKey().
+ *
+ * The state of the editing is encapsulated into the pointed linenoiseState
+ * structure as described in the structure definition. */
+inline void Editor::completeLineCycle(struct linenoiseState *ls) {
+    if (completions.Empty()) {
+        linenoiseBeep(ls);
+        return;
+    }
+    ls->cycle_size = static_cast<int>(completions.Size());
+    ls->cycle_pos = ls->pos;
+    ls->cycle_len = -1;
+    completeLineShow(ls, 0);
+    refreshLine(ls);
+}
+
+/* Handle key 'c' while cycling through the completions: Tab shows the
+ * next one, the original text after the last one. Other keys end the
+ * cycle, escape showing the original text again, and return false to be
+ * handled as usual. */
+inline bool Editor::completeLineCycleKey(struct linenoiseState *ls, int c, int action) {
+    int size = ls->cycle_size;
+    int i = ls->cycle_index;
+    if (action == ACTION_COMPLETE) {
+        i = (i+1) % (size+1);
+        if (i == size) linenoiseBeep(ls);
+        completeLineShow(ls, i);
+        refreshLine(ls);
+        return true;
+    }
+    if (c == ESC && i < size) {
+        /* Re-show original buffer */
+        completeLineShow(ls, size);
+        refreshLine(ls);
+    }
+    /* Other keys keep the shown candidate. */
+    ls->cycle_index = -1;
+    return false;
+}
+
+/* Fill 'completions' for the current buffer calling the completion
+ * callback on this thread. */
+inline void Editor::linenoiseCollectCompletions(struct linenoiseState *ls) {
+    completions.Clear();
+    if (completionScoreCallback) {
+        completions.BeginRanking(completionScoreCallback, completion_rank_max, StringView(ls->buf, ls->len), ls->pos);
+    }
+    if (completionRangeCallback) {
+        completionRangeCallback(StringView(ls->buf, ls->len), ls->pos, completions);
+    } else if (asyncCompletionCallback) {
+        asyncCompletionCallback(StringView(ls->buf, ls->len), ls->pos, completions, CancellationToken());
+    } else {
+        std::vector<std::string> lc;
+        completionCallback(ls->buf,lc);
+        for (const auto& s: lc) completions.Add(0, ls->len, s);
+        /* Not known to be prefix matches. */
+        completions.SetNarrowable(false);
+    }
+    completions.EndRanking();
+}
+
+/* Remember the buffer 'completions' were computed for, so the next Tab
+ * can narrow them. Candidate sets past the size bound are not kept. */
+inline void Editor::linenoiseCacheCompletions(StringView buffer, size_t pos) {
+    completion_cache_valid = false;
+    if (completions.Narrowable() && completions.Bytes() <= LINENOISE_COMPLETION_CACHE_MAX) {
+        completion_cache_buffer.assign(buffer.data(), buffer.size());
+        completion_cache_pos = pos;
+        completion_cache_valid = true;
+    }
+}
+
+/* Reuse the completions of the previous Tab when the buffer only differs
+ * from theirs by text typed at their cursor position, filtering them
+ * instead of calling the completion callback again. */
+inline bool Editor::linenoiseNarrowCompletions(struct linenoiseState *ls) {
+    if (!completion_cache_valid) return false;
+    const std::string& old = completion_cache_buffer;
+    size_t p = completion_cache_pos;
+    size_t len = ls->len, pos = ls->pos;
+    if (len < old.size() || pos < p || pos - p != len - old.size()) return false;
+    if (memcmp(ls->buf, old.data(), p) || memcmp(ls->buf + pos, old.data() + p, old.size() - p)) return false;
+    if (!narrowCompletions(completions, StringView(ls->buf, len), p, pos - p)) return false;
+    linenoiseCacheCompletions(StringView(ls->buf, len), pos);
+    return true;
+}
+
+inline void Editor::completeLine(struct linenoiseState *ls) {
+    linenoiseCollectCompletions(ls);
+    linenoiseCacheCompletions(StringView(ls->buf, ls->len), ls->pos);
+    completeLineCycle(ls);
+}
+
+/* Post a request computing the completions of the current buffer on
+ * completion_worker with whichever completion callback is registered. */
+inline std::shared_ptr<CompletionRequest> Editor::linenoiseStartCompletion(struct linenoiseState *ls) {
+    std::shared_ptr<CompletionRequest> req = std::make_shared<CompletionRequest>();
+    req->buffer.assign(ls->buf, ls->len);
+    req->pos = ls->pos;
+    req->generation = ls->generation;
+    CompletionCallback fn = completionCallback;
+    CompletionRangeCallback rangeFn = completionRangeCallback;
+    AsyncCompletionCallback asyncFn = asyncCompletionCallback;
+    if (completionScoreCallback) {
+        req->result.BeginRanking(completionScoreCallback, completion_rank_max, StringView(req->buffer), req->pos);
+    }
+    completion_worker.Post([fn, rangeFn, asyncFn, req]() {
+        if (!req->token.Cancelled()) {
+            if (asyncFn) {
+                asyncFn(StringView(req->buffer), req->pos, req->result, req->token);
+            } else if (rangeFn) {
+                rangeFn(StringView(req->buffer), req->pos, req->result);
+            } else {
+                std::vector<std::string> lc;
+                fn(req->buffer.c_str(), lc);
+                for (const auto& s: lc) req->result.Add(0, req->buffer.size(), s);
+                req->result.SetNarrowable(false);
+            }
+            req->result.EndRanking();
+        }
+        req->done.store(true, std::memory_order_release);
+    });
+    return req;
+}
+
+/* True if 'req' was made for the current buffer content and cursor. */
+inline bool Editor::linenoiseCompletionMatches(struct linenoiseState *ls, const CompletionRequest& req) {
+    return req.pos == static_cast<size_t>(ls->pos) &&
+           req.buffer.size() == static_cast<size_t>(ls->len) &&
+           !memcmp(req.buffer.data(), ls->buf, ls->len);
+}
+
+/* Start computing the completions of the current buffer on
+ * completion_worker, cancelling the previous request, or adopt the
+ * prefetch in progress for it. The edit loop keeps handling keys and shows
+ * them once they arrive, if the buffer and the cursor did not change
+ * meanwhile. */
+inline void Editor::linenoiseRequestCompletion(struct linenoiseState *ls) {
+    if (ls->completion_request) ls->completion_request->token.Cancel();
+    if (ls->completion_prefetch && linenoiseCompletionMatches(ls, *ls->completion_prefetch)) {
+        ls->completion_request = ls->completion_prefetch;
+        ls->completion_request->generation = ls->generation;
+        ls->completion_prefetch.reset();
+        return;
+    }
+    ls->completion_request = linenoiseStartCompletion(ls);
+}
+
+/* Set how many milliseconds without keys pass before the completions of
+ * the current buffer are computed in the background, so that Tab shows
+ * them at once. 0, the default, disables prefetching. The completion
+ * callback then runs on a background thread. */
+inline void Editor::SetCompletionPrefetch(int idle_ms) {
+    prefetch_idle_ms = idle_ms < 0 ? 0 : idle_ms;
+}
+
+inline void SetCompletionPrefetch(int idle_ms) {
+    DefaultEditor().SetCompletionPrefetch(idle_ms);
+}
+
+/* Milliseconds left without keys before the completions of the current
+ * buffer are prefetched, or -1 if there is nothing to do. */
+inline int Editor::linenoisePrefetchTimeout(struct linenoiseState *ls) {
+    if (!prefetch_idle_ms || ls->completion_request) return -1;
+    if (!completionCallback && !completionRangeCallback && !asyncCompletionCallback) return -1;
+    if (ls->completion_prefetch && linenoiseCompletionMatches(ls, *ls->completion_prefetch)) return -1;
+    auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - ls->idle_since);
+    return static_cast<int>(std::max<long long>(0, prefetch_idle_ms - static_cast<long long>(idle.count())));
+}
+
+inline void Editor::linenoiseStartPrefetch(struct linenoiseState *ls) {
+    if (ls->completion_prefetch) ls->completion_prefetch->token.Cancel();
+    ls->completion_prefetch = linenoiseStartCompletion(ls);
+}
+
+/* Take the prefetched completions if they are done and were computed for
+ * the current buffer content and cursor. */
+inline bool Editor::linenoiseTakePrefetch(struct linenoiseState *ls) {
+    std::shared_ptr<CompletionRequest>& req = ls->completion_prefetch;
+    if (!req || !req->done.load(std::memory_order_acquire) ||
+        req->token.Cancelled() || !linenoiseCompletionMatches(ls, *req)) return false;
+    std::swap(completions, req->result);
+    linenoiseCacheCompletions(StringView(req->buffer), req->pos);
+    req.reset();
+    return true;
+}
+
+/* Take the completions of the request in flight if they are done and
+ * still apply to the buffer. */
+inline bool Editor::linenoiseTakeCompletion(struct linenoiseState *ls) {
+    std::shared_ptr<CompletionRequest>& req = ls->completion_request;
+    if (!req || !req->done.load(std::memory_order_acquire)) return false;
+    bool current = !req->token.Cancelled() &&
+                   req->generation == ls->generation &&
+                   req->pos == static_cast<size_t>(ls->pos);
+    if (current) {
+        std::swap(completions, req->result);
+        linenoiseCacheCompletions(StringView(req->buffer), req->pos);
+    }
+    req.reset();
+    return current;
+}
+
+/* Take the next candidate of the completion menu. */
+inline bool Editor::completeLineMenuPull(struct linenoiseState *ls, std::string& out) {
+    if (ls->menu_has_carry) {
+        out.swap(ls->menu_carry);
+        ls->menu_has_carry = false;
+        return true;
+    }
+    if (ls->menu_next && ls->menu_next(out)) return true;
+    ls->menu_next = nullptr;
+    return false;
+}
+
+/* List a page of the completion menu below the line, starting with the
+ * candidates in 'page', in columns sized to the terminal. When candidates
+ * are left it waits at a --More-- prompt, otherwise the line is shown
+ * again below the menu. */
+inline void Editor::completeLineMenuPage(struct linenoiseState *ls, std::vector<std::string> page) {
+    std::string cand;
+    int cols, rows;
+    linenoiseTerminalSize(&cols, &rows);
+    rows = std::max(1, rows - 1);
+    int maxw = 0;
+    for (const auto& p: page) maxw = std::max(maxw, unicodeColumnPos(p.c_str(), static_cast<int>(p.size())));
+
+    /* Take candidates while they fit in a page of columns as wide as the
+     * widest one, which is carried to the next page otherwise. */
+    int cap = std::max(1, cols / (maxw + 2)) * rows;
+    while (static_cast<int>(page.size()) < cap && completeLineMenuPull(ls, cand)) {
+        int w = unicodeColumnPos(cand.c_str(), static_cast<int>(cand.size()));
+        if (w > maxw) {
+            int wcap = std::max(1, cols / (w + 2)) * rows;
+            if (!page.empty() && static_cast<int>(page.size()) >= wcap) {
+                ls->menu_carry.swap(cand);
+                ls->menu_has_carry = true;
+                break;
+            }
+            maxw = w;
+            cap = wcap;
+        }
+        page.push_back(cand);
+    }
+
+    int n = static_cast<int>(page.size());
+    int ncols = std::max(1, cols / (maxw + 2));
+    int nrows = (n + ncols - 1) / ncols;
+    std::string ab;
+    for (int r = 0; r < nrows; r++) {
+        for (int col = 0; col < ncols; col++) {
+            int i = col * nrows + r;
+            if (i >= n) break;
+            ab += page[i];
+            if (col + 1 < ncols && i + nrows < n) {
+                int w = unicodeColumnPos(page[i].c_str(), static_cast<int>(page[i].size()));
+                ab.append(maxw + 2 - w, ' ');
+            }
+        }
+        ab += "\r\n";
+    }
+
+    ls->menu_waiting = ls->menu_has_carry ||
+        (ls->menu_has_carry = completeLineMenuPull(ls, ls->menu_carry));
+    if (ls->menu_waiting) {
+        ab += "--More--";
+        if (linenoiseWrite(ls->output,ab.c_str(),static_cast<int>(ab.length())) == -1) {}
+        return;
+    }
+    if (linenoiseWrite(ls->output,ab.c_str(),static_cast<int>(ab.length())) == -1) {}
+
+    /* Show the line again below the menu. */
+    ls->maxrows = 0;
+    ls->oldcolpos = 0;
+    refreshLine(ls);
+}
+
+/* Tab-completion with the menu callback: a single candidate replaces its
+ * range of the buffer, more are listed below the line one page at a time
+ * with a --More-- prompt (Space or Tab for the next page, any other key
+ * to stop, see completeLineMenuKey()). Candidates are pulled from the
+ * generator only as pages are shown, so only the visible page is ever
+ * produced and measured. */
+inline void Editor::completeLineMenu(struct linenoiseState *ls) {
+    size_t start = ls->pos, end = ls->pos;
+    std::string first;
+    ls->menu_next = completionMenuCallback(StringView(ls->buf, ls->len), ls->pos, start, end);
+    ls->menu_has_carry = false;
+
+    if (!completeLineMenuPull(ls, first)) {
+        linenoiseBeep(ls);
+        return;
+    }
+    if (!completeLineMenuPull(ls, ls->menu_carry)) {
+        start = std::min(start, (size_t)ls->len);
+        end = std::max(start, std::min(end, (size_t)ls->len));
+        linenoiseEditReplace(ls, static_cast<int>(start), static_cast<int>(end - start), first.data(), static_cast<int>(first.size()));
+        refreshLine(ls);
+        return;
+    }
+
+    ls->menu_has_carry = true;
+
+    /* Continue below the end of the line. */
+    int pos = ls->pos;
+    ls->pos = ls->len;
+    refreshLine(ls);
+    ls->pos = pos;
+    if (linenoiseWrite(ls->output,"\r\n",2) == -1) {}
+    completeLineMenuPage(ls, std::vector<std::string>(1, first));
+}
+
+/* Handle key 'c' at the --More-- prompt of the completion menu. */
+inline void Editor::completeLineMenuKey(struct linenoiseState *ls, int c, int action) {
+    ls->menu_waiting = false;
+    if (linenoiseWrite(ls->output,"\r\x1b[0K",5) == -1) {}
+    if (c == ' ' || action == ACTION_COMPLETE) {
+        completeLineMenuPage(ls, std::vector<std::string>());
+        return;
+    }
+    ls->menu_next = nullptr;
+    ls->menu_has_carry = false;
+    ls->maxrows = 0;
+    ls->oldcolpos = 0;
+    refreshLine(ls);
+}
+
+/* Register a tab-completion callback for large candidate sets. It receives
+ * the buffer and the cursor position, sets the range [start, end) of the
+ * buffer a candidate replaces and returns a generator yielding one
+ * candidate per call, returning false when there are no more. Candidates
+ * are listed in a paginated menu and only generated as pages are shown.
+ * It replaces the other completion callbacks. */
+inline void Editor::SetCompletionMenuCallback(CompletionMenuCallback fn) {
+    completionMenuCallback = fn;
+    completionCallback = nullptr;
+    completionRangeCallback = nullptr;
+    asyncCompletionCallback = nullptr;
+    completion_cache_valid = false;
+}
+
+inline void SetCompletionMenuCallback(CompletionMenuCallback fn) {
+    DefaultEditor().SetCompletionMenuCallback(fn);
+}
+
+/* Rank the candidates of the completion callbacks by 'score', best first,
+ * keeping only the 'k' best ones (all of them when 0) while they are
+ * added, so Tab stays fast and small however many candidates a source
+ * yields. ScoreCompletion() is a reasonable default. Pass nullptr to show
+ * candidates in the order the callback adds them again. */
+inline void Editor::SetCompletionRanking(CompletionScoreCallback score, size_t k) {
+    completionScoreCallback = score;
+    completion_rank_max = k;
+    completion_cache_valid = false;
+}
+
+inline void SetCompletionRanking(CompletionScoreCallback score, size_t k) {
+    DefaultEditor().SetCompletionRanking(score, k);
+}
+
+/* Register a callback function to be called for tab-completion. */
+inline void Editor::SetCompletionCallback(CompletionCallback fn) {
+    completion_cache_valid = false;
+    completionMenuCallback = nullptr;
+    completionCallback = fn;
+    completionRangeCallback = nullptr;
+    asyncCompletionCallback = nullptr;
+}
+
+inline void SetCompletionCallback(CompletionCallback fn) {
+    DefaultEditor().SetCompletionCallback(fn);
+}
+
+/* Register a tab-completion callback run on a background thread, so that
+ * a slow completion source never blocks typing. A new Tab or any edit
+ * cancels the request in flight through the token, which the callback may
+ * poll to stop early; results are only shown if the buffer and the cursor
+ * are still the ones they were computed for. On Windows the callback runs
+ * synchronously. It replaces the other completion callbacks. */
+inline void Editor::SetAsyncCompletionCallback(AsyncCompletionCallback fn) {
+    completion_cache_valid = false;
+    completionMenuCallback = nullptr;
+    asyncCompletionCallback = fn;
+    completionCallback = nullptr;
+    completionRangeCallback = nullptr;
+}
+
+inline void SetAsyncCompletionCallback(AsyncCompletionCallback fn) {
+    DefaultEditor().SetAsyncCompletionCallback(fn);
+}
+
+/* Register a tab-completion callback receiving the buffer and the cursor
+ * position, and adding candidates that each replace a range of the buffer,
+ * typically the word under the cursor. It replaces the callback registered
+ * with SetCompletionCallback(). */
+inline void Editor::SetCompletionRangeCallback(CompletionRangeCallback fn) {
+    completion_cache_valid = false;
+    completionMenuCallback = nullptr;
+    completionRangeCallback = fn;
+    completionCallback = nullptr;
+    asyncCompletionCallback = nullptr;
+}
+
+inline void SetCompletionRangeCallback(CompletionRangeCallback fn) {
+    DefaultEditor().SetCompletionRangeCallback(fn);
+}
+
+/* ============================ Completion trie ============================= */
+
+/* Return the range [start, end) of the word under the cursor at 'pos'. */
+inline void completionWordRange(StringView buffer, size_t pos, size_t *start, size_t *end) {
+    *start = pos;
+    while (*start > 0 && !isspace((unsigned char)buffer[*start-1])) (*start)--;
+    *end = pos;
+    while (*end < buffer.size() && !isspace((unsigned char)buffer[*end])) (*end)++;
+}
+
+/* A radix trie over a vocabulary of words, for completing the word under
+ * the cursor. Looking up a prefix costs O(prefix length + results) instead
+ * of a scan of every word on each Tab. Nodes are 20 bytes kept in one
+ * vector, siblings are linked in byte order and edge labels are ranges of
+ * a single pool holding each inserted suffix once.
+ *
+ *   linenoise::CompletionTrie trie;
+ *   trie.Add("hello");
+ *   linenoise::SetCompletionRangeCallback(trie.Callback());
+ */
+class CompletionTrie {
+public:
+    CompletionTrie() : words(0) { Clear(); }
+
+    void Clear() {
+        nodes.assign(1, Node());
+        labels.clear();
+        words = 0;
+    }
+
+    /* Number of distinct words added. */
+    size_t Size() const { return words; }
+
+    void Add(StringView word) {
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < word.size()) {
+            uint32_t prev = NIL;
+            uint32_t child = findChild(node, (unsigned char)word[i], &prev);
+            if (child == NIL) {
+                /* New leaf holding the rest of the word. */
+                Node leaf;
+                leaf.label = static_cast<uint32_t>(labels.size());
+                leaf.label_len = static_cast<uint32_t>(word.size() - i);
+                leaf.terminal = true;
+                labels.append(word.data() + i, word.size() - i);
+                link(node, prev, push(leaf));
+                words++;
+                return;
+            }
+            uint32_t common = commonPrefix(child, word, i);
+            if (common < nodes[child].label_len) {
+                /* Split the edge: a new node takes the shared part. */
+                Node mid;
+                mid.label = nodes[child].label;
+                mid.label_len = common;
+                mid.next = nodes[child].next;
+                mid.child = child;
+                uint32_t m = push(mid);
+                nodes[child].label += common;
+                nodes[child].label_len -= common;
+                nodes[child].next = NIL;
+                if (prev == NIL) nodes[node].child = m;
+                else nodes[prev].next = m;
+                child = m;
+            }
+            node = child;
+            i += common;
+        }
+        if (!nodes[node].terminal && node != 0) {
+            nodes[node].terminal = true;
+            words++;
+        }
+    }
+
+    /* A generator yielding the words starting with 'prefix' one at a time,
+     * in byte order. The trie must outlive it and not change meanwhile. */
+    CompletionGenerator Generate(StringView prefix) const {
+        std::vector<std::pair<uint32_t, size_t>> stack;
+        std::string word;
+        uint32_t node = locate(prefix, word);
+        if (node == 0) pushChildren(stack, 0, 0);
+        else if (node != NIL) stack.push_back(std::make_pair(node, word.size()));
+        return [this, stack, word](std::string& out) mutable {
+            while (!stack.empty()) {
+                std::pair<uint32_t, size_t> top = stack.back();
+                stack.pop_back();
+                const Node& n = nodes[top.first];
+                word.resize(top.second);
+                word.append(labels, n.label, n.label_len);
+                pushChildren(stack, top.first, word.size());
+                if (n.terminal) {
+                    out = word;
+                    return true;
+                }
+            }
+            return false;
+        };
+    }
+
+    /* Call fn(word) for every word starting with 'prefix', in byte order.
+     * Stops early when fn returns false. */
+    void ForEach(StringView prefix, const std::function<bool (StringView)>& fn) const {
+        CompletionGenerator next = Generate(prefix);
+        std::string word;
+        while (next(word) && fn(StringView(word))) {}
+    }
+
+    /* Add the words completing the word under the cursor to 'out'. */
+    void Complete(StringView buffer, size_t pos, Completions& out) const {
+        size_t start, end;
+        completionWordRange(buffer, pos, &start, &end);
+        ForEach(buffer.substr(start, pos - start), [&](StringView word) {
+            out.Add(start, end, word);
+            return true;
+        });
+    }
+
+    /* A completion callback using this trie, which must outlive it. */
+    CompletionRangeCallback Callback() const {
+        return [this](StringView buffer, size_t pos, Completions& out) {
+            Complete(buffer, pos, out);
+        };
+    }
+
+    /* A completion menu callback generating the words completing the word
+     * under the cursor from this trie, which must outlive it. */
+    CompletionMenuCallback MenuCallback() const {
+        return [this](StringView buffer, size_t pos, size_t& start, size_t& end) {
+            completionWordRange(buffer, pos, &start, &end);
+            return Generate(buffer.substr(start, pos - start));
+        };
+    }
+
+private:
+    static const uint32_t NIL = 0xFFFFFFFF;
+
+    struct Node {
+        Node() : label(0), label_len(0), child(NIL), next(NIL), terminal(false) {}
+        uint32_t label;     /* Edge label offset in 'labels'. */
+        uint32_t label_len; /* Edge label length. */
+        uint32_t child;     /* First child, NIL for none. */
+        uint32_t next;      /* Next sibling in byte order, NIL for none. */
+        bool terminal;      /* A word ends here. */
+    };
+
+    uint32_t push(const Node& n) {
+        nodes.push_back(n);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    /* Find the child of 'node' whose label starts with 'ch'. 'prev' is set
+     * to the sibling after which such a child is or would be linked. */
+    uint32_t findChild(uint32_t node, unsigned char ch, uint32_t *prev) const {
+        *prev = NIL;
+        for (uint32_t c = nodes[node].child; c != NIL; c = nodes[c].next) {
+            unsigned char first = labels[nodes[c].label];
+            if (first == ch) return c;
+            if (first > ch) break;
+            *prev = c;
+        }
+        return NIL;
+    }
+
+    void link(uint32_t parent, uint32_t prev, uint32_t n) {
+        if (prev == NIL) {
+            nodes[n].next = nodes[parent].child;
+            nodes[parent].child = n;
+        } else {
+            nodes[n].next = nodes[prev].next;
+            nodes[prev].next = n;
+        }
+    }
+
+    uint32_t commonPrefix(uint32_t node, StringView word, size_t i) const {
+        const Node& n = nodes[node];
+        uint32_t k = 0;
+        while (k < n.label_len && i + k < word.size() && labels[n.label + k] == word[i + k]) k++;
+        return k;
+    }
+
+    /* Find the node whose subtree holds the words starting with 'prefix',
+     * or NIL. 'word' is set to the text before the label of that node. */
+    uint32_t locate(StringView prefix, std::string& word) const {
+        uint32_t node = 0;
+        size_t i = 0;
+        word.clear();
+        while (i < prefix.size()) {
+            uint32_t prev;
+            uint32_t child = findChild(node, (unsigned char)prefix[i], &prev);
+            if (child == NIL) return NIL;
+            uint32_t common = commonPrefix(child, prefix, i);
+            if (i + common >= prefix.size()) return child;
+            if (common < nodes[child].label_len) return NIL;
+            word.append(labels, nodes[child].label, nodes[child].label_len);
+            node = child;
+            i += common;
+        }
+        return node;
+    }
+
+    /* Push the children of 'node' so that the first one is popped first. */
+    void pushChildren(std::vector<std::pair<uint32_t, size_t>>& stack, uint32_t node, size_t len) const {
+        size_t n = 0;
+        for (uint32_t c = nodes[node].child; c != NIL; c = nodes[c].next) n++;
+        stack.resize(stack.size() + n);
+        size_t i = stack.size();
+        for (uint32_t c = nodes[node].child; c != NIL; c = nodes[c].next) {
+            stack[--i] = std::make_pair(c, len);
+        }
+    }
+
+    std::vector<Node> nodes; /* nodes[0] is the root. */
+    std::string labels;
+    size_t words;
+};
+
+/* ========================== Completion dictionary ========================= */
+
+/* On-disk dictionary of sorted words, searched in place through mmap() so
+ * opening it costs O(1) whatever its size and processes share its pages.
+ *
+ * Layout, integers in host byte order:
+ *
+ *   header   "LNDICT1" NUL, uint32 words, uint32 words per block,
+ *            uint64 blocks
+ *   offsets  uint64[blocks + 1], block offsets from the start of the data
+ *   data     blocks of front-coded words: the first word is stored as
+ *            varint length + bytes, each next one as varint length shared
+ *            with the previous word, varint suffix length + suffix bytes.
+ *
+ * The first word of every block is stored whole, so a prefix is found by
+ * a binary search over the blocks and a scan of the matching words. The
+ * example/mkdict tool builds dictionaries from word lists. */
+#define LINENOISE_DICT_MAGIC "LNDICT1"
+#define LINENOISE_DICT_BLOCK 16
+
+/* Write 'words' as a dictionary to 'path'. The words are sorted and
+ * duplicates removed first. Returns false on error. */
+inline bool BuildDictionary(std::vector<std::string> words, const char *path) {
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    auto varint = [](std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out += static_cast<char>((v & 0x7F) | 0x80);
+            v >>= 7;
+        }
+        out += static_cast<char>(v);
+    };
+
+    std::string data;
+    std::vector<uint64_t> offsets;
+    for (size_t i = 0; i < words.size(); i++) {
+        if (i % LINENOISE_DICT_BLOCK == 0) {
+            offsets.push_back(data.size());
+            varint(data, words[i].size());
+            data += words[i];
+        } else {
+            const std::string& prev = words[i-1];
+            size_t shared = 0;
+            while (shared < prev.size() && shared < words[i].size() && prev[shared] == words[i][shared]) shared++;
+            varint(data, shared);
+            varint(data, words[i].size() - shared);
+            data.append(words[i], shared, std::string::npos);
+        }
+    }
+    offsets.push_back(data.size());
+
+    std::ofstream f(path, std::ios::binary);
+    if (!f) return false;
+    uint32_t count = static_cast<uint32_t>(words.size());
+    uint32_t block = LINENOISE_DICT_BLOCK;
+    uint64_t blocks = offsets.size() - 1;
+    f.write(LINENOISE_DICT_MAGIC, 8);
+    f.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    f.write(reinterpret_cast<const char *>(&block), sizeof(block));
+    f.write(reinterpret_cast<const char *>(&blocks), sizeof(blocks));
+    f.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    f.write(data.data(), data.size());
+    return static_cast<bool>(f);
+}
+
+/* A dictionary built by BuildDictionary(), mapped read-only. */
+class CompletionDictionary {
+public:
+    CompletionDictionary() : base(NULL), size(0), words(0), blocks(0), offsets(NULL), data(NULL) {}
+    ~CompletionDictionary() { Close(); }
+    CompletionDictionary(const CompletionDictionary&) = delete;
+    CompletionDictionary& operator=(const CompletionDictionary&) = delete;
+
+    /* Map the dictionary at 'path'. Returns false if it can not be opened
+     * or is not a valid dictionary. */
+    bool Open(const char *path) {
+        Close();
+#ifndef _WIN32
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_size < 24) {
+            close(fd);
+            return false;
+        }
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        base = static_cast<const char *>(p);
+        size = static_cast<size_t>(st.st_size);
+#else
+        /* No mmap(): read the file once. */
+        std::ifstream f(path, std::ios::binary);
+        if (!f) return false;
+        contents.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        base = contents.data();
+        size = contents.size();
+#endif
+        uint32_t count;
+        uint64_t nblocks;
+        if (size < 24 || memcmp(base, LINENOISE_DICT_MAGIC, 8)) {
+            Close();
+            return false;
+        }
+        memcpy(&count, base + 8, sizeof(count));
+        memcpy(&nblocks, base + 16, sizeof(nblocks));
+        if (nblocks >= (size - 24) / sizeof(uint64_t)) {
+            Close();
+            return false;
+        }
+        words = count;
+        blocks = static_cast<size_t>(nblocks);
+        offsets = base + 24;
+        data = offsets + (blocks + 1) * sizeof(uint64_t);
+        /* Blocks are never empty: the offsets must increase and stay
+         * within the data. */
+        uint64_t limit = static_cast<uint64_t>(base + size - data);
+        for (size_t i = 0; i <= blocks; i++) {
+            if (offset(i) > limit || (i && offset(i) <= offset(i - 1))) {
+                Close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Close() {
+#ifndef _WIN32
+        if (base) munmap(const_cast<char *>(base), size);
+#else
+        contents.clear();
+#endif
+        base = NULL;
+        size = words = blocks = 0;
+    }
+
+    /* Number of words in the dictionary. */
+    size_t Size() const { return words; }
+
+    /* A generator yielding the words starting with 'prefix' one at a time,
+     * in byte order. The dictionary must stay open meanwhile. */
+    CompletionGenerator Generate(StringView prefix) const {
+        /* First block whose first word is not below the prefix: matches
+         * may start in the block before it. */
+        size_t lo = 0, hi = blocks;
+        std::string word;
+        bool corrupt = false;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            const char *p = data + offset(mid);
+            if (!decode(p, data + offset(mid + 1), word, true)) {
+                corrupt = true; /* Nothing is found in a corrupted file. */
+                break;
+            }
+            if (StringView(word) < prefix) lo = mid + 1;
+            else hi = mid;
+        }
+        size_t b = corrupt ? blocks : lo ? lo - 1 : 0;
+        std::string want(prefix.data(), prefix.size());
+        const char *p = NULL, *end = NULL;
+        bool first = true;
+        return [this, b, want, word, p, end, first](std::string& out) mutable {
+            StringView pre(want);
+            while (b < blocks) {
+                if (!p) {
+                    p = data + offset(b);
+                    end = data + offset(b + 1);
+                    first = true;
+                }
+                if (p >= end) {
+                    b++;
+                    p = NULL;
+                    continue;
+                }
+                if (!decode(p, end, word, first)) break;
+                first = false;
+                StringView w(word);
+                if (w.size() >= pre.size() && w.substr(0, pre.size()) == pre) {
+                    out = word;
+                    return true;
+                }
+                if (pre < w) break;
+            }
+            b = blocks;
+            return false;
+        };
+    }
+
+    /* Call fn(word) for every word starting with 'prefix', in byte order.
+     * Stops early when fn returns false. */
+    void ForEach(StringView prefix, const std::function<bool (StringView)>& fn) const {
+        CompletionGenerator next = Generate(prefix);
+        std::string word;
+        while (next(word) && fn(StringView(word))) {}
+    }
+
+    /* Add the words completing the word under the cursor to 'out'. */
+    void Complete(StringView buffer, size_t pos, Completions& out) const {
+        size_t start, end;
+        completionWordRange(buffer, pos, &start, &end);
+        ForEach(buffer.substr(start, pos - start), [&](StringView word) {
+            out.Add(start, end, word);
+            return true;
+        });
+    }
+
+    /* A completion callback using this dictionary, which must outlive it. */
+    CompletionRangeCallback Callback() const {
+        return [this](StringView buffer, size_t pos, Completions& out) {
+            Complete(buffer, pos, out);
+        };
+    }
+
+    /* A completion menu callback generating the words completing the word
+     * under the cursor from this dictionary, which must outlive it. */
+    CompletionMenuCallback MenuCallback() const {
+        return [this](StringView buffer, size_t pos, size_t& start, size_t& end) {
+            completionWordRange(buffer, pos, &start, &end);
+            return Generate(buffer.substr(start, pos - start));
+        };
+    }
+
+private:
+    uint64_t offset(size_t block) const {
+        uint64_t o;
+        memcpy(&o, offsets + block * sizeof(uint64_t), sizeof(o));
+        return o;
+    }
+
+    static bool varint(const char *&p, const char *end, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            unsigned char b = static_cast<unsigned char>(*p++);
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    /* Decode the word at 'p' into 'word', which holds the previous word
+     * unless 'first'. Returns false on a corrupted block. */
+    static bool decode(const char *&p, const char *end, std::string& word, bool first) {
+        uint64_t shared = 0, len;
+        if (!first && !varint(p, end, shared)) return false;
+        if (!varint(p, end, len)) return false;
+        if (shared > word.size() || len > static_cast<uint64_t>(end - p)) return false;
+        word.resize(static_cast<size_t>(shared));
+        word.append(p, static_cast<size_t>(len));
+        p += len;
+        return true;
+    }
+
+    const char *base;    /* Mapped file. */
+    size_t size;
+    size_t words;
+    size_t blocks;
+    const char *offsets; /* Block offsets table in the file. */
+    const char *data;    /* Front-coded blocks in the file. */
+#ifdef _WIN32
+    std::string contents;
+#endif
+};
+
+/* ============================ Path completion ============================= */
+
+#ifndef _WIN32
+
+#ifndef LINENOISE_DIRECTORY_CACHE_MAX
+#define LINENOISE_DIRECTORY_CACHE_MAX 64
+#endif
+
+/* Listings of directories, read once and kept until the directory changes.
+ * On Linux changes are reported by inotify, elsewhere the modification
+ * time of the directory is checked on each lookup. Safe to use from the
+ * completion worker thread. */
+class DirectoryCache {
+public:
+    struct Entry {
+        std::string name;
+        bool dir;
+    };
+    typedef std::vector<Entry> Listing; /* Sorted by name. */
+
+    DirectoryCache() : notify_fd(-1) {
+#ifdef __linux__
+        notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+    ~DirectoryCache() {
+        if (notify_fd != -1) close(notify_fd);
+    }
+    DirectoryCache(const DirectoryCache&) = delete;
+    DirectoryCache& operator=(const DirectoryCache&) = delete;
+
+    /* The listing of the directory 'path', without "." and "..", or NULL
+     * if it can not be read. Only changed directories are read again; the
+     * same listing is returned while the directory does not change. */
+    std::shared_ptr<const Listing> List(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        drainEvents();
+        auto it = dirs.find(path);
+        if (it != dirs.end() && it->second.listing && fresh(it->second, path)) {
+            return it->second.listing;
+        }
+        if (it == dirs.end()) {
+            if (dirs.size() >= LINENOISE_DIRECTORY_CACHE_MAX) clear();
+            it = dirs.insert(std::make_pair(path, Directory())).first;
+            watch(it->second, path);
+        }
+        Directory& d = it->second;
+        struct stat st;
+        d.mtime = stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+        d.listed = time(NULL);
+        d.listing = load(path);
+        return d.listing;
+    }
+
+    /* Forget every listing. */
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        clear();
+    }
+
+private:
+    struct Directory {
+        Directory() : wd(-1), mtime(0), listed(0) {}
+        std::shared_ptr<const Listing> listing;
+        int wd;       /* inotify watch, -1 without one. */
+        time_t mtime; /* Of the directory when listed. */
+        time_t listed;
+    };
+
+    static std::shared_ptr<const Listing> load(const std::string& path) {
+        DIR *dir = opendir(path.c_str());
+        if (!dir) return nullptr;
+        std::shared_ptr<Listing> listing = std::make_shared<Listing>();
+        while (struct dirent *de = readdir(dir)) {
+            const char *name = de->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+            Entry e = { name, false };
+#ifdef _DIRENT_HAVE_D_TYPE
+            if (de->d_type == DT_DIR) e.dir = true;
+            else if (de->d_type == DT_LNK || de->d_type == DT_UNKNOWN)
+#endif
+            {
+                struct stat st;
+                std::string file = path + "/" + name;
+                e.dir = stat(file.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+            }
+            listing->push_back(std::move(e));
+        }
+        closedir(dir);
+        std::sort(listing->begin(), listing->end(), [](const Entry& a, const Entry& b) {
+            return a.name < b.name;
+        });
+        return listing;
+    }
+
+    /* Whether a listing can still be used. With inotify it is dropped as
+     * soon as the directory changes. Otherwise its modification time must
+     * not have changed, and a listing made in the second of the last change
+     * is read again, as it may have missed changes made within it. */
+    bool fresh(const Directory& d, const std::string& path) const {
+        if (d.wd != -1) return true;
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1) return false;
+        return st.st_mtime == d.mtime && d.mtime < d.listed;
+    }
+
+    void watch(Directory& d, const std::string& path) {
+#ifdef __linux__
+        if (notify_fd == -1) return;
+        /* IN_ATTRIB catches permission changes, e.g. of executables. */
+        d.wd = inotify_add_watch(notify_fd, path.c_str(),
+            IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+            IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        if (d.wd != -1) watched[d.wd] = path;
+#else
+        (void)d;
+        (void)path;
+#endif
+    }
+
+    /* Drop the listings of the directories inotify reported changes in. */
+    void drainEvents() {
+#ifdef __linux__
+        if (notify_fd == -1) return;
+        alignas(struct inotify_event) char buf[4096];
+        ssize_t n;
+        while ((n = ::read(notify_fd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + n; ) {
+                const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>(p);
+                p += sizeof(struct inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    /* Events were lost. */
+                    for (auto& d: dirs) d.second.listing.reset();
+                    continue;
+                }
+                auto w = watched.find(ev->wd);
+                if (w == watched.end()) continue;
+                auto it = dirs.find(w->second);
+                if (ev->mask & IN_IGNORED) {
+                    /* The watch is gone with the directory. */
+                    if (it != dirs.end()) dirs.erase(it);
+                    watched.erase(w);
+                } else if (it != dirs.end()) {
+                    it->second.listing.reset();
+                }
+            }
+        }
+#endif
+    }
+
+    void clear() {
+#ifdef __linux__
+        for (const auto& w: watched) inotify_rm_watch(notify_fd, w.first);
+        /* Pending events of the removed watches are ignored. */
+        watched.clear();
+#endif
+        dirs.clear();
+    }
+
+    std::mutex mutex;
+    int notify_fd;
+    std::unordered_map<std::string, Directory> dirs;
+    std::unordered_map<int, std::string> watched; /* Watch to directory. */
+};
+
+/* Completes file names with the directory listings cached in a
+ * DirectoryCache, so Tab in a large directory only reads it the first
+ * time. The word under the cursor is split and unquoted like a shell
+ * does: quotes and backslashes are understood and kept, names are quoted
+ * the same way, and a leading ~ or ~user stands for a home directory. */
+class CompletionPaths {
+public:
+    /* Add the paths completing the word under the cursor to 'out'. */
+    void Complete(StringView buffer, size_t pos, Completions& out) {
+        size_t start, end, dir_end;
+        char dir_quote, quote;
+        std::string word;
+        pathWordAt(buffer, pos, &start, &end, &dir_end, &dir_quote, &quote, word);
+        /* Listings are cached but hidden files depend on what is typed. */
+        out.SetNarrowable(false);
+
+        size_t slash = word.rfind('/');
+        std::string dir = slash == std::string::npos ? std::string() : word.substr(0, slash + 1);
+        std::string prefix = word.substr(dir.size());
+        if (word[0] == '~') {
+            if (slash == std::string::npos) {
+                if (word == "~") out.Add(start, end, StringView("~/"));
+                return;
+            }
+            size_t user_end = word.find('/');
+            std::string home = homeDirectory(word.substr(1, user_end - 1));
+            if (home.empty()) return;
+            dir = home + dir.substr(user_end);
+        }
+        if (dir.empty() || dir[0] != '/') {
+            char cwd[PATH_MAX];
+            if (!getcwd(cwd, sizeof(cwd))) return;
+            dir = std::string(cwd) + "/" + dir;
+        }
+        if (dir.size() > 1) dir.resize(dir.size() - 1); /* Drop the trailing '/'. */
+
+        std::shared_ptr<const DirectoryCache::Listing> listing = cache.List(dir);
+        if (!listing) return;
+        auto it = std::lower_bound(listing->begin(), listing->end(), prefix,
+            [](const DirectoryCache::Entry& e, const std::string& p) { return e.name < p; });
+        char q = dir_quote ? dir_quote : quote;
+        std::string candidate;
+        for (; it != listing->end() && !it->name.compare(0, prefix.size(), prefix); ++it) {
+            if (it->name[0] == '.' && prefix.empty()) continue;
+            candidate.assign(buffer.data() + start, dir_end - start);
+            if (!dir_quote && quote) candidate += quote;
+            quoteName(candidate, it->name, q);
+            if (it->dir) candidate += '/';
+            else if (q) candidate += q;
+            out.Add(start, end, candidate);
+        }
+    }
+
+    /* A completion callback using this completer, which must outlive it. */
+    CompletionRangeCallback Callback() {
+        return [this](StringView buffer, size_t pos, Completions& out) {
+            Complete(buffer, pos, out);
+        };
+    }
+
+    /* The directory listings, kept until the directories change. */
+    DirectoryCache& Cache() { return cache; }
+
+private:
+    /* Find the shell word under the cursor: its range [start, end), the end
+     * of its directory part 'dir_end' (after the last '/' before the
+     * cursor), the quote open there and at the cursor, and the unquoted
+     * text of the word up to the cursor. */
+    static void pathWordAt(StringView buffer, size_t pos, size_t *start, size_t *end, size_t *dir_end,
+                           char *dir_quote, char *quote, std::string& word) {
+        char q = 0;
+        *start = *dir_end = 0;
+        *dir_quote = *quote = 0;
+        word.clear();
+        size_t i = 0;
+        for (; i < buffer.size(); i++) {
+            char c = buffer[i];
+            if (i <= pos) *quote = q;
+            if (!q && isspace((unsigned char)c)) {
+                if (i >= pos) break;
+                *start = *dir_end = i + 1;
+                word.clear();
+                continue;
+            }
+            bool literal = true;
+            if (c == '\\' && q != '\'' && i + 1 < buffer.size()) {
+                c = buffer[++i];
+            } else if (c == q) {
+                q = 0;
+                literal = false;
+            } else if (!q && (c == '\'' || c == '"')) {
+                q = c;
+                literal = false;
+            }
+            if (i >= pos) continue;
+            if (literal) word += c;
+            if (literal && c == '/') {
+                *dir_end = i + 1;
+                *dir_quote = q;
+            }
+        }
+        if (i <= pos) *quote = q;
+        *end = std::max(i, pos);
+    }
+
+    /* Append 'name' to 'out' quoted for the quote 'q' is open, or with
+     * backslashes when there is none. */
+    static void quoteName(std::string& out, const std::string& name, char q) {
+        for (char c: name) {
+            if (q == '\'') {
+                if (c == '\'') out += "'\\'";
+            } else if (q == '"') {
+                if (strchr("\"\\$`", c)) out += '\\';
+            } else if (strchr(" \t\n\\'\"$`&|;<>()*?[]!{}#", c)) {
+                out += '\\';
+            }
+            out += c;
+        }
+    }
+
+    /* The home directory of 'user', or of the current user when empty. */
+    static std::string homeDirectory(const std::string& user) {
+        if (user.empty()) {
+            const char *home = getenv("HOME");
+            if (home && *home) return home;
+        }
+        /* The _r variants: completion runs on the worker thread. */
+        long hint = sysconf(_SC_GETPW_R_SIZE_MAX);
+        std::vector<char> buf(hint > 0 ? static_cast<size_t>(hint) : 1024);
+        struct passwd pwd, *pw = NULL;
+        for (;;) {
+            int err = user.empty() ? getpwuid_r(getuid(), &pwd, buf.data(), buf.size(), &pw)
+                                   : getpwnam_r(user.c_str(), &pwd, buf.data(), buf.size(), &pw);
+            if (err != ERANGE || buf.size() >= 1 << 20) break;
+            buf.resize(buf.size() * 2);
+        }
+        return pw && pw->pw_dir ? pw->pw_dir : "";
+    }
+
+    DirectoryCache cache;
+};
+
+/* Completes the first word of the line with the names of the executables
+ * in the directories of $PATH. Their listings are kept in a DirectoryCache
+ * and merged into one sorted index, so Tab is a binary search; only the
+ * directories that changed since are read again and checked for execute
+ * permission. Safe to use from the completion worker thread. */
+class CompletionExecutables {
+public:
+    CompletionExecutables() : built(false) {
+        const char *path = getenv("PATH");
+        SetPath(path ? path : "");
+    }
+
+    /* Index the directories of the ':' separated list 'path' instead. */
+    void SetPath(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        dirs.clear();
+        size_t from = 0;
+        while (from <= path.size()) {
+            size_t to = path.find(':', from);
+            if (to == std::string::npos) to = path.size();
+            /* An empty entry is the current directory, which changes too
+             * often to be worth indexing. */
+            if (to > from) {
+                Source s;
+                s.dir = path.substr(from, to - from);
+                dirs.push_back(s);
+            }
+            from = to + 1;
+        }
+        built = false;
+    }
+
+    /* Build the index on a background thread, so that the first Tab does
+     * not wait for it. */
+    void BuildInBackground() {
+        worker.Post([this]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            update();
+        });
+    }
+
+    /* Call fn(name) for every executable starting with 'prefix', in byte
+     * order. Stops early when fn returns false. */
+    void ForEach(StringView prefix, const std::function<bool (StringView)>& fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        update();
+        std::string p(prefix.data(), prefix.size());
+        for (auto it = std::lower_bound(names.begin(), names.end(), p);
+             it != names.end() && !it->compare(0, p.size(), p); ++it) {
+            if (!fn(StringView(*it))) return;
+        }
+    }
+
+    /* Add the executables completing the first word of the line, when the
+     * cursor is in it, to 'out'. */
+    void Complete(StringView buffer, size_t pos, Completions& out) {
+        size_t start, end;
+        completionWordRange(buffer, pos, &start, &end);
+        for (size_t i = 0; i < start; i++) {
+            if (!isspace((unsigned char)buffer[i])) return;
+        }
+        ForEach(buffer.substr(start, pos - start), [&](StringView name) {
+            out.Add(start, end, name);
+            return true;
+        });
+    }
+
+    /* A completion callback using this index, which must outlive it. */
+    CompletionRangeCallback Callback() {
+        return [this](StringView buffer, size_t pos, Completions& out) {
+            Complete(buffer, pos, out);
+        };
+    }
+
+    size_t Size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        update();
+        return names.size();
+    }
+
+private:
+    struct Source {
+        std::string dir;
+        std::shared_ptr<const DirectoryCache::Listing> listing;
+        std::vector<std::string> executables; /* Sorted. */
+    };
+
+    /* Bring the index up to date with the directories, which the cache
+     * does without reading those that did not change. */
+    void update() {
+        bool changed = !built;
+        for (auto& s: dirs) {
+            std::shared_ptr<const DirectoryCache::Listing> listing = cache.List(s.dir);
+            if (listing == s.listing) continue;
+            s.listing = listing;
+            s.executables.clear();
+            if (listing) {
+                std::string file;
+                for (const auto& e: *listing) {
+                    if (e.dir) continue;
+                    file = s.dir + "/" + e.name;
+                    if (access(file.c_str(), X_OK) == 0) s.executables.push_back(e.name);
+                }
+            }
+            changed = true;
+        }
+        if (!changed) return;
+        names.clear();
+        for (const auto& s: dirs) {
+            size_t mid = names.size();
+            names.insert(names.end(), s.executables.begin(), s.executables.end());
+            std::inplace_merge(names.begin(), names.begin() + mid, names.end());
+        }
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        built = true;
+    }
+
+    std::mutex mutex;
+    DirectoryCache cache;
+    std::vector<Source> dirs;
+    std::vector<std::string> names; /* Sorted, without duplicates. */
+    bool built;
+    BackgroundWorker worker; /* Last, so its thread stops first. */
+};
+
+#endif /* _WIN32 */
+
+/* =========================== Line editing ================================= */
+
+/* Write to 'seq' the SGR sequence for an ANSI 'color' (-1 for the default
+ * one) and 'bold' flag, or an empty string when both are the default. */
+inline void refreshStyleSequence(char *seq, int color, int bold) {
+    if (bold == 1 && color == -1) color = 37;
+    if (color != -1 || bold != 0)
+        snprintf(seq,64,"\033[%d;%d;49m",bold,color);
+    else
+        seq[0] = '\0';
+}
+
+/* Append l->buf[from, to) to 'ab' with the SGR sequences of the highlight
+ * spans covering it. Column widths are always computed on the buffer, so
+ * the sequences do not change the cursor position. */
+inline void refreshAppendHighlighted(std::string& ab, struct linenoiseState *l, int from, int to) {
+    char seq[64];
+    int off = from;
+    for (size_t i = 0; i < l->hl_spans.size(); i++) {
+        const HighlightSpan& sp = l->hl_spans[i];
+        int a = std::max(sp.offset, off);
+        int b = std::min(sp.offset + sp.length, to);
+        if (b <= a) {
+            if (sp.offset >= to) break;
+            continue;
+        }
+        refreshStyleSequence(seq, sp.color, sp.bold);
+        ab.append(l->buf + off, a - off);
+        ab += seq;
+        ab.append(l->buf + a, b - a);
+        if (seq[0]) ab += "\x1b[0m";
+        off = b;
+    }
+    ab.append(l->buf + off, to - off);
+}
+
+/* Append as much of 'text' as fits in 'room' columns to 'ab', wrapped in
+ * the SGR attributes 'sgr'. */
+inline void refreshAppendStyled(std::string& ab, std::string& text, int room, const char *sgr) {
+    int tlen = static_cast<int>(text.size());
+    char *tbuf = &text[0];
+    while (tlen > 0 && unicodeColumnPos(tbuf, tlen) > room) {
+        tlen -= unicodePrevGraphemeLen(tbuf, tlen);
+    }
+    if (tlen > 0) {
+        ab += sgr;
+        ab.append(tbuf, tlen);
+        ab += "\x1b[0m";
+    }
+}
+
+/* Append the hint after the buffer when the whole line fits on the first
+ * row of the terminal, like the hints of the original linenoise. */
+inline void refreshShowHints(std::string& ab, struct linenoiseState *l, int pcolwid) {
+    int colwid = pcolwid + unicodeColumnPos(l->buf, l->len);
+    if (l->hint.empty() || colwid >= l->cols) return;
+    char seq[64];
+    refreshStyleSequence(seq, l->hint_color, l->hint_bold);
+    refreshAppendStyled(ab, l->hint, l->cols - colwid, seq);
+}
+
+/* Single line low level line refresh.
+ *
+ * Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. */
+inline void refreshSingleLine(struct linenoiseState *l) {
+    char seq[64];
+    int pcolwid = unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()));
+    char *buf = l->buf;
+    int len = l->len;
+    int pos = l->pos;
+    std::string ab;
+
+    while((pcolwid+unicodeColumnPos(buf, pos)) >= l->cols) {
+        int glen = unicodeGraphemeLen(buf, len, 0);
+        buf += glen;
+        len -= glen;
+        pos -= glen;
+    }
+    while (pcolwid+unicodeColumnPos(buf, len) > l->cols) {
+        len -= unicodePrevGraphemeLen(buf, len);
+    }
+
+    /* Cursor to left edge */
+    snprintf(seq,64,"\r");
+    ab += seq;
+    /* Write the prompt and the current buffer content */
+    ab += l->prompt;
+    refreshAppendHighlighted(ab, l, static_cast<int>(buf - l->buf), static_cast<int>(buf - l->buf) + len);
+    /* Write as much of the suggestion or hint as fits on the line */
+    if (!l->suggestion.empty() && len == l->len) {
+        refreshAppendStyled(ab, l->suggestion, l->cols - pcolwid - unicodeColumnPos(buf, len), "\x1b[90m");
+    }
+    refreshShowHints(ab, l, pcolwid);
+    /* Erase to right */
+    snprintf(seq,64,"\x1b[0K");
+    ab += seq;
+    /* Move cursor to original position. */
+    snprintf(seq,64,"\r\x1b[%dC", (int)(unicodeColumnPos(buf, pos)+pcolwid));
+    ab += seq;
+    if (linenoiseWrite(l->output,ab.c_str(), static_cast<int>(ab.length())) == -1) {} /* Can't recover from write error. */
+}
+
+/* Append to 'ab' what erases the rows used by the line in multi line
+ * mode, leaving the cursor at the start of the first one. */
+inline void refreshClearRows(std::string& ab, struct linenoiseState *l) {
+    char seq[64];
+    int pcolwid = unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()));
+    int rpos = (pcolwid+l->oldcolpos+l->cols)/l->cols; /* cursor relative row. */
+    int old_rows = (int)l->maxrows;
+    int j;
+
+    /* First step: clear all the lines used before. To do so start by
+     * going to the last row. */
+    if (old_rows-rpos > 0) {
+        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
+        ab += seq;
+    }
+
+    /* Now for every row clear it, go up. */
+    for (j = 0; j < old_rows-1; j++) {
+        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
+        ab += seq;
+    }
+
+    /* Clean the top line. */
+    snprintf(seq,64,"\r\x1b[0K");
+    ab += seq;
+}
+
+/* Multi line low level line refresh.
+ *
+ * Rewrite the currently edited line accordingly to the buffer content,
+ * cursor position, and number of columns of the terminal. */
+inline void refreshMultiLine(struct linenoiseState *l) {
+    char seq[64];
+    int pcolwid = unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()));
+    std::string text(l->buf, l->len); /* buffer plus suggestion. */
+    text += l->suggestion;
+    int colpos = unicodeColumnPosForMultiLine(&text[0], static_cast<int>(text.size()), static_cast<int>(text.size()), l->cols, pcolwid);
+    int colpos2; /* cursor column position. */
+    int rows = (pcolwid+colpos+l->cols-1)/l->cols; /* rows used by current buf. */
+    int rpos2; /* rpos after refresh. */
+    int col; /* colum position, zero-based. */
+    std::string ab;
+
+    refreshClearRows(ab, l);
+
+    /* Update maxrows if needed. */
+    if (rows > (int)l->maxrows) l->maxrows = rows;
+
+    /* Write the prompt, the current buffer content and the suggestion */
+    ab += l->prompt;
+    refreshAppendHighlighted(ab, l, 0, l->len);
+    if (!l->suggestion.empty()) {
+        ab += "\x1b[90m";
+        ab += l->suggestion;
+        ab += "\x1b[0m";
+    }
+    refreshShowHints(ab, l, pcolwid);
+
+    /* Get text width to cursor position */
+    colpos2 = unicodeColumnPosForMultiLine(l->buf, l->len, l->pos, l->cols, pcolwid);
+
+    /* If we are at the very end of the screen with our prompt, we need to
+     * emit a newline and move the prompt to the first column. */
+    if (l->pos &&
+        l->pos == l->len &&
+        l->suggestion.empty() &&
+        (colpos2+pcolwid) % l->cols == 0)
+    {
+        ab += "\n";
+        snprintf(seq,64,"\r");
+        ab += seq;
+        rows++;
+        if (rows > (int)l->maxrows) l->maxrows = rows;
+    }
+
+    /* Move cursor to right position. */
+    rpos2 = (pcolwid+colpos2+l->cols)/l->cols; /* current cursor relative row. */
+
+    /* Go up till we reach the expected positon. */
+    if (rows-rpos2 > 0) {
+        snprintf(seq,64,"\x1b[%dA", rows-rpos2);
+        ab += seq;
+    }
+
+    /* Set column. */
+    col = (pcolwid + colpos2) % l->cols;
+    if (col)
+        snprintf(seq,64,"\r\x1b[%dC", col);
+    else
+        snprintf(seq,64,"\r");
+    ab += seq;
+
+    l->oldcolpos = colpos2;
+
+    if (linenoiseWrite(l->output,ab.c_str(), static_cast<int>(ab.length())) == -1) {} /* Can't recover from write error. */
+}
+
+/* Update the history suggestion for the current buffer: the newest entry
+ * that extends it, shown with the cursor at the end of the line. The
+ * entries starting with the buffer are a range of the sorted history
+ * index, found in O(log n). When the buffer extends the one of the last
+ * lookup, the previous hit is kept if it still extends it: no newer entry
+ * matched the shorter buffer, so none matches this one. */
+inline void Editor::linenoiseUpdateSuggestion(struct linenoiseState *l) {
+    std::string prev;
+    prev.swap(l->suggest_for);
+    l->suggestion.clear();
+    if (!asmode || l->len == 0 || l->pos != l->len || history.empty()) {
+        l->suggest_hit = ULONG_MAX;
+        return;
+    }
+
+    size_t len = static_cast<size_t>(l->len);
+    unsigned long current = history_base + history.size() - 1; /* The line edited. */
+    l->suggest_for.assign(l->buf, len);
+    if (!prev.empty() && len >= prev.size() && !l->suggest_for.compare(0, prev.size(), prev)) {
+        if (l->suggest_hit == ULONG_MAX) return;
+        if (l->suggest_hit >= history_base && l->suggest_hit < current) {
+            const std::string &h = history[l->suggest_hit - history_base];
+            if (h.size() > len && !h.compare(0, len, l->suggest_for)) {
+                l->suggestion = h.substr(len);
+                return;
+            }
+        }
+    }
+
+    l->suggest_hit = ULONG_MAX;
+    StringView typed(l->suggest_for);
+    for (auto it = historyLowerBound(typed); it != history_index.end(); ++it) {
+        StringView h = historyLine(*it);
+        if (h.size() < len || h.substr(0, len) != typed) break;
+        if (h.size() > len && *it < current && (l->suggest_hit == ULONG_MAX || *it > l->suggest_hit)) {
+            l->suggest_hit = *it;
+        }
+    }
+    if (l->suggest_hit != ULONG_MAX) l->suggestion = history[l->suggest_hit - history_base].substr(len);
+}
+
+/* Calls the two low level functions refreshSingleLine() or
+ * refreshMultiLine() according to the selected mode. */
+inline void Editor::refreshLine(struct linenoiseState *l) {
+    linenoiseUpdateSuggestion(l);
+    linenoiseUpdateHint(l);
+    linenoiseUpdateHighlight(l);
+    if (mlmode)
+        refreshMultiLine(l);
+    else
+        refreshSingleLine(l);
+}
+
+/* Insert the character 'c' at cursor current position.
+ *
+ * On error writing to the terminal -1 is returned, otherwise 0. */
+inline int Editor::linenoiseEditInsert(struct linenoiseState *l, const char* cbuf, int clen) {
+    if (l->len < l->buflen) {
+        linenoiseEditChanged(l, l->pos, 0, clen);
+        if (l->len == l->pos) {
+            memcpy(&l->buf[l->pos],cbuf,clen);
+            l->pos+=clen;
+            l->len+=clen;;
+            l->buf[l->len] = '\0';
+            unsigned long hit = l->suggest_hit;
+            bool shown = !l->suggestion.empty();
+            int pcolwid = unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()));
+            linenoiseUpdateSuggestion(l);
+            if ((!mlmode && pcolwid+unicodeColumnPos(l->buf,l->len) < l->cols) /* || mlmode */ &&
+                !highlightCallback &&
+                shown == !l->suggestion.empty() && (!shown || hit == l->suggest_hit)) {
+                /* Avoid a full update of the line in the
+                 * trivial case. Typing over a suggestion that still
+                 * applies leaves its remaining ghost text in place,
+                 * and a hint is patched in after the character. */
+                std::string ab(cbuf, clen);
+                bool hinted = !l->hint.empty();
+                linenoiseUpdateHint(l);
+                if (hinted || !l->hint.empty()) {
+                    char seq[64];
+                    refreshShowHints(ab, l, pcolwid);
+                    snprintf(seq,64,"\x1b[0K\r\x1b[%dC", pcolwid+unicodeColumnPos(l->buf,l->len));
+                    ab += seq;
+                }
+                if (linenoiseWrite(l->output,ab.c_str(),static_cast<int>(ab.length())) == -1) return -1;
+            } else {
+                refreshLine(l);
+            }
+        } else {
+            memmove(l->buf+l->pos+clen,l->buf+l->pos,l->len-l->pos);
+            memcpy(&l->buf[l->pos],cbuf,clen);
+            l->pos+=clen;
+            l->len+=clen;
+            l->buf[l->len] = '\0';
+            refreshLine(l);
+        }
+    }
+    return 0;
+}
+
+/* Append the suggestion shown after the cursor to the buffer. Returns
+ * false if there is no suggestion to accept. */
+inline bool Editor::linenoiseEditAcceptSuggestion(struct linenoiseState *l) {
+    if (l->suggestion.empty() || l->pos != l->len) return false;
+    int slen = std::min(static_cast<int>(l->suggestion.size()), l->buflen - l->len);
+    linenoiseEditChanged(l, l->len, 0, slen);
+    memcpy(l->buf + l->len, l->suggestion.data(), slen);
+    l->len += slen;
+    l->pos = l->len;
+    l->buf[l->len] = '\0';
+    refreshLine(l);
+    return true;
+}
+
+/* Remove the suggestion and the hint from the screen, used when the line
+ * is done. */
+inline void Editor::linenoiseEditHideSuggestion(struct linenoiseState *l) {
+    if (!l->suggestion.empty() || !l->hint.empty()) {
+        l->suggestion.clear();
+        l->suggest_for.clear();
+        l->hint.clear();
+        if (mlmode)
+            refreshMultiLine(l);
+        else
+            refreshSingleLine(l);
+    }
+}
+
+/* Move cursor on the left. */
+inline void Editor::linenoiseEditMoveLeft(struct linenoiseState *l) {
+    if (l->pos > 0) {
+        l->pos -= unicodePrevGraphemeLen(l->buf, l->pos);
+        refreshLine(l);
+    }
+}
+
+/* Move cursor on the right. */
+inline void Editor::linenoiseEditMoveRight(struct linenoiseState *l) {
+    if (l->pos != l->len) {
+        l->pos += unicodeGraphemeLen(l->buf, l->len, l->pos);
+        refreshLine(l);
+    }
+}
+
+/* Move cursor to the start of the line. */
+inline void Editor::linenoiseEditMoveHome(struct linenoiseState *l) {
+    if (l->pos != 0) {
+        l->pos = 0;
+        refreshLine(l);
+    }
+}
+
+/* Move cursor to the end of the line. */
+inline void Editor::linenoiseEditMoveEnd(struct linenoiseState *l) {
+    if (l->pos != l->len) {
+        l->pos = l->len;
+        refreshLine(l);
+    }
+}
+
+#define LINENOISE_HISTORY_NEXT 0
+#define LINENOISE_HISTORY_PREV 1
+
+/* Whether the history search shows entry 'seq': it starts with 'prefix',
+ * is not 'skip', and is the newest entry with its line. Equal lines are
+ * adjacent in the index, by age, so that is one O(log n) lookup. */
+inline bool Editor::historyShownMatch(unsigned long seq, StringView prefix, const std::string& skip) {
+    StringView line = historyLine(seq);
+    if (line.size() < prefix.size() || line.substr(0, prefix.size()) != prefix) return false;
+    if (line == StringView(skip)) return false;
+    unsigned long current = history_base + history.size() - 1;
+    auto next = history_index.find(seq);
+    if (next != history_index.end()) ++next;
+    return next == history_index.end() || *next == current || historyLine(*next) != line;
+}
+
+/* Show the next or previous history entry starting with the text that was
+ * before the cursor when the search started, newest first, like zsh's
+ * history-beginning-search. Nothing is collected up front: each step walks
+ * the history from the entry shown to the next one matching, so its cost
+ * is the number of entries passed, and a prefix that no entry starts with
+ * is told at once by the sorted index. Stepping past the newest match
+ * restores the line that was being edited. */
+inline void Editor::linenoiseEditHistorySearch(struct linenoiseState *l, int dir) {
+    completion_cache_valid = false;
+    if (!l->search_active || l->search_shown != l->buf) {
+        /* Start a new search from the text before the cursor. */
+        l->search_orig = l->buf;
+        l->search_prefix = l->pos;
+        l->search_hit = ULONG_MAX;
+        l->search_active = true;
+    }
+
+    StringView prefix(l->search_orig.data(), l->search_prefix);
+    auto first = historyLowerBound(prefix);
+    if (first == history_index.end()) return;
+    StringView lowest = historyLine(*first);
+    if (lowest.size() < prefix.size() || lowest.substr(0, prefix.size()) != prefix) return;
+
+    unsigned long current = history_base + history.size() - 1; /* The line edited. */
+    unsigned long seq = l->search_hit == ULONG_MAX ? current : l->search_hit;
+    unsigned long hit = ULONG_MAX;
+    if (dir == LINENOISE_HISTORY_PREV) {
+        while (seq > history_base && hit == ULONG_MAX) {
+            seq--;
+            if (historyShownMatch(seq, prefix, l->search_orig)) hit = seq;
+        }
+        if (hit == ULONG_MAX) return;
+    } else {
+        if (l->search_hit == ULONG_MAX) return;
+        if (seq < history_base) seq = history_base - 1; /* Trimmed meanwhile. */
+        while (seq + 1 < current && hit == ULONG_MAX) {
+            seq++;
+            if (historyShownMatch(seq, prefix, l->search_orig)) hit = seq;
+        }
+    }
+    l->search_hit = hit;
+    const std::string &line = (hit == ULONG_MAX) ? l->search_orig :
+        history[hit - history_base];
+    int old_len = l->len;
+    l->len = static_cast<int>(std::min(line.size(), (size_t)l->buflen));
+    linenoiseEditChanged(l, 0, old_len, l->len);
+    memcpy(l->buf, line.data(), l->len);
+    l->buf[l->len] = '\0';
+    l->pos = static_cast<int>(std::min(l->search_prefix, (size_t)l->len));
+    l->search_shown = l->buf;
+    refreshLine(l);
+}
+
+/* Substitute the currently edited line with the next or previous history
+ * entry as specified by 'dir'. */
+inline void Editor::linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
+    completion_cache_valid = false;
+    if (hsmode && l->history_index == 0 &&
+        ((l->search_active && l->search_shown == l->buf) || l->pos > 0)) {
+        linenoiseEditHistorySearch(l, dir);
+        return;
+    }
+    /* SetHistoryMaxLen() may have dropped the entry shown meanwhile. */
+    if (l->history_index >= (int)history.size())
+        l->history_index = static_cast<int>(history.size()) - 1;
+    if (history.size() > 1) {
+        /* Update the current history entry before to
+         * overwrite it with the next one. */
+        historyReplace(history.size() - 1 - l->history_index, l->buf);
+        /* Show the new entry */
+        l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
+        if (l->history_index < 0) {
+            l->history_index = 0;
+            return;
+        } else if (l->history_index >= (int)history.size()) {
+            l->history_index = static_cast<int>(history.size())-1;
+            return;
+        }
+        int old_len = l->len;
+        memset(l->buf, 0, l->buflen);
+        strcpy(l->buf,history[history.size() - 1 - l->history_index].c_str());
+        l->len = l->pos = static_cast<int>(strlen(l->buf));
+        linenoiseEditChanged(l, 0, old_len, l->len);
+        refreshLine(l);
+    }
+}
+
+/* Delete the character at the right of the cursor without altering the cursor
+ * position. Basically this is what happens with the "Delete" keyboard key. */
+inline void Editor::linenoiseEditDelete(struct linenoiseState *l) {
+    if (l->len > 0 && l->pos < l->len) {
+        int glen = unicodeGraphemeLen(l->buf,l->len,l->pos);
+        linenoiseEditChanged(l, l->pos, glen, 0);
+        memmove(l->buf+l->pos,l->buf+l->pos+glen,l->len-l->pos-glen);
+        l->len-=glen;
+        l->buf[l->len] = '\0';
+        refreshLine(l);
+    }
+}
+
+/* Backspace implementation. */
+inline void Editor::linenoiseEditBackspace(struct linenoiseState *l) {
+    if (l->pos > 0 && l->len > 0) {
+        int glen = unicodePrevGraphemeLen(l->buf,l->pos);
+        linenoiseEditChanged(l, l->pos-glen, glen, 0);
+        memmove(l->buf+l->pos-glen,l->buf+l->pos,l->len-l->pos);
+        l->pos-=glen;
+        l->len-=glen;
+        l->buf[l->len] = '\0';
+        refreshLine(l);
+    }
+}
+
+/* Delete the previosu word, maintaining the cursor at the start of the
+ * current word. */
+inline void Editor::linenoiseEditDeletePrevWord(struct linenoiseState *l) {
+    int old_pos = l->pos;
+    int diff;
+
+    while (l->pos > 0 && l->buf[l->pos-1] == ' ')
+        l->pos--;
+    while (l->pos > 0 && l->buf[l->pos-1] != ' ')
+        l->pos--;
+    diff = old_pos - l->pos;
+    linenoiseEditChanged(l, l->pos, diff, 0);
+    memmove(l->buf+l->pos,l->buf+old_pos,l->len-old_pos+1);
+    l->len -= diff;
+    refreshLine(l);
+}
+
+/* Move the cursor to the start of the word before it, words being
+ * separated by spaces as for ctrl-w. */
+inline void Editor::linenoiseEditMoveWordLeft(struct linenoiseState *l) {
+    int pos = l->pos;
+    while (pos > 0 && l->buf[pos-1] == ' ') pos--;
+    while (pos > 0 && l->buf[pos-1] != ' ') pos--;
+    if (pos != l->pos) {
+        l->pos = pos;
+        refreshLine(l);
+    }
+}
+
+/* Move the cursor to the end of the word after it. */
+inline void Editor::linenoiseEditMoveWordRight(struct linenoiseState *l) {
+    int pos = l->pos;
+    while (pos < l->len && l->buf[pos] == ' ') pos++;
+    while (pos < l->len && l->buf[pos] != ' ') pos++;
+    if (pos != l->pos) {
+        l->pos = pos;
+        refreshLine(l);
+    }
+}
+
+/* Delete from the cursor to the end of the word after it. */
+inline void Editor::linenoiseEditDeleteNextWord(struct linenoiseState *l) {
+    int end = l->pos;
+    while (end < l->len && l->buf[end] == ' ') end++;
+    while (end < l->len && l->buf[end] != ' ') end++;
+    if (end == l->pos) return;
+    linenoiseEditReplace(l, l->pos, end - l->pos, "", 0);
+    refreshLine(l);
+}
+
+/* Milliseconds until the input buffered can be decoded: 0 when it holds
+ * a key, the time left to wait for the rest of an unfinished sequence,
+ * -1 when it is empty. */
+inline int Editor::linenoiseInputTimeout() {
+    if (input_start == input_end) return -1;
+    if (!input_waiting) return 0;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(input_deadline - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<long long>(0, left.count()));
+}
+
+/* Decode the next key of the terminal input into *key, and its bytes when
+ * it is a character into 'bytes', which has room for 4. The input is read
+ * as a block when the buffer has no key yet. Returns the length of the
+ * key, 0 at end of file, -1 on errors, and LINENOISE_EDIT_MORE when no key
+ * is complete yet. On Windows it waits for a key of the console. */
+inline int Editor::linenoiseReadKey(struct linenoiseState *l, int *key, char *bytes) {
+#ifndef _WIN32
+    while (1) {
+        int avail = input_end - input_start;
+        if (avail > 0) {
+            bool expired = input_waiting && linenoiseInputTimeout() == 0;
+            int n = linenoiseDecodeKey(input + input_start, avail, expired || avail == LINENOISE_INPUT_BUFFER, key);
+            if (n > 0) {
+                memcpy(bytes, input + input_start, std::min(n, 4));
+                input_start += n;
+                input_waiting = false;
+                return n;
+            }
+            if (!input_waiting) {
+                input_waiting = true;
+                input_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(escape_timeout_ms);
+            }
+            /* Only read the rest of the sequence if it arrived already. */
+            struct pollfd fd;
+            fd.fd = l->ifd;
+            fd.events = POLLIN;
+            if (poll(&fd, 1, 0) != 1) return LINENOISE_EDIT_MORE;
+        }
+        if (input_start > 0) {
+            memmove(input, input + input_start, avail);
+            input_start = 0;
+            input_end = avail;
+        }
+        ssize_t nread = read(l->ifd, input + input_end, LINENOISE_INPUT_BUFFER - input_end);
+        if (nread > 0) {
+            input_end += static_cast<int>(nread);
+            continue;
+        }
+        if (nread == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return LINENOISE_EDIT_MORE;
+            return -1;
+        }
+        if (avail == 0) return 0;
+        /* End of file after an unfinished sequence: take it as it is. */
+        input_deadline = std::chrono::steady_clock::now();
+    }
+#else
+    (void)l;
+    int nread = win32read(key);
+    if (nread == 1) bytes[0] = static_cast<char>(*key);
+    return nread;
+#endif
+}
+
+/* Lay the line out again when the terminal width changed, erasing the rows
+ * drawn at the old width first. */
+inline void Editor::linenoiseEditResize(struct linenoiseState *l) {
+    int cols, rows;
+    linenoiseTerminalSize(&cols, &rows);
+    if (cols == l->cols) return;
+    if (l == &edit_state && edit_hidden) {
+        l->cols = cols;
+        return;
+    }
+    if (mlmode) {
+        std::string ab;
+        refreshClearRows(ab, l);
+        if (linenoiseWrite(l->output,ab.c_str(),static_cast<int>(ab.length())) == -1) {}
+        l->maxrows = 0;
+        l->oldcolpos = 0;
+    }
+    l->cols = cols;
+    refreshLine(l);
+}
+
+/* Wait at most 'timeout' milliseconds (-1 for ever, 0 not at all) for the
+ * terminal to have input, handling the background work done meanwhile:
+ * the line is redrawn when a hint that was not ready in time is computed
+ * or the terminal is resized, and the completions that arrive for the
+ * current buffer are shown.
+ * Returns 1 when there is input, 0 on timeout and -1 on errors. */
+inline int Editor::linenoiseEditPoll(struct linenoiseState *l, int timeout) {
+#ifndef _WIN32
+    int input_timeout = linenoiseInputTimeout();
+    if (input_timeout == 0) return 1;
+    if (input_timeout > 0 && (timeout < 0 || input_timeout < timeout)) timeout = input_timeout;
+    while (1) {
+        struct pollfd fds[4];
+        fds[0].fd = l->ifd;
+        fds[1].fd = hints_worker.WakeFd();
+        fds[2].fd = completion_worker.WakeFd(); /* poll() skips fds of -1. */
+        fds[3].fd = term_cols > 0 ? -1 : resize_watcher.Fd();
+        for (int i = 0; i < 4; i++) {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (fds[1].fd == -1 && fds[2].fd == -1 && fds[3].fd == -1 && timeout < 0) return 1;
+
+        int n = poll(fds, 4, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return linenoiseInputTimeout() == 0 ? 1 : 0;
+        if (fds[1].revents & POLLIN) {
+            hints_worker.ClearWake();
+            if (l->hint_waiting) refreshLine(l);
+        }
+        if (fds[2].revents & POLLIN) {
+            completion_worker.ClearWake();
+            if (linenoiseTakeCompletion(l)) completeLineCycle(l);
+        }
+        if (fds[3].revents & POLLIN) {
+            resize_watcher.Clear();
+            linenoiseEditResize(l);
+        }
+        if (fds[0].revents) return 1;
+        if (timeout == 0) return 0;
+    }
+#else
+    (void)l;
+    (void)timeout;
+    return 1;
+#endif
+}
+
+/* Wait until the terminal has input, prefetching the completions of the
+ * current buffer when idle. Returns false on error. */
+inline bool Editor::linenoiseWaitInput(struct linenoiseState *l) {
+    while (1) {
+        int n = linenoiseEditPoll(l, linenoisePrefetchTimeout(l));
+        if (n == 0) {
+            /* Idle: compute the completions Tab would ask for. */
+            linenoiseStartPrefetch(l);
+            continue;
+        }
+        return n == 1;
+    }
+}
+
+/* Start editing a line in 'buf' with the terminal 'stdin_fd' and
+ * 'stdout_fd', which must already be in "raw mode", showing the prompt.
+ * Returns -1 if the prompt can not be written. */
+inline int Editor::linenoiseEditStart(struct linenoiseState *l, int stdin_fd, int stdout_fd, char *buf, int buflen, const char *prompt)
+{
+    /* Populate the linenoise state that we pass to functions implementing
+     * specific editing functionalities. */
+    l->ifd = stdin_fd;
+    l->ofd = stdout_fd;
+    l->output = &output;
+    l->buf = buf;
+    l->buflen = buflen;
+    l->prompt = prompt;
+    l->oldcolpos = l->pos = 0;
+    l->len = 0;
+    if (term_cols <= 0) resize_watcher.Start();
+    int rows;
+    linenoiseTerminalSize(&l->cols, &rows);
+    l->maxrows = 0;
+    l->history_index = 0;
+    l->search_active = false;
+    l->search_prefix = 0;
+    l->search_hit = ULONG_MAX;
+    l->suggest_for.clear(); /* History may have changed since the last line. */
+    l->suggest_hit = ULONG_MAX;
+    l->hint_color = -1;
+    l->hint_bold = 0;
+    l->hint_waiting = false;
+    l->hl_dirty_start = -1;
+    l->hl_dirty_end = 0;
+    l->generation = 0;
+    l->cycle_index = -1;
+    l->cycle_len = -1;
+    l->menu_has_carry = false;
+    l->menu_waiting = false;
+    l->idle_since = std::chrono::steady_clock::now();
+    completion_cache_valid = false;
+
+    /* Buffer starts empty. */
+    l->buf[0] = '\0';
+    l->buflen--; /* Make sure there is always space for the nulterm */
+
+    /* The latest history entry is always our current buffer, that
+     * initially is just an empty string. */
+    AddHistory("");
+
+    if (linenoiseWrite(l->output,prompt, static_cast<int>(l->prompt.length())) == -1) return -1;
+    return 0;
+}
+
+/* Read and handle one key of the line being edited. Returns
+ * LINENOISE_EDIT_MORE while editing goes on, the length of the line once
+ * it is entered or on read errors, and -1 on ctrl-c or ctrl-d on an empty
+ * line. */
+inline int Editor::linenoiseEditFeed(struct linenoiseState *l)
+{
+    int c;
+    char cbuf[4];
+    int nread;
+    char *buf = l->buf;
+
+    nread = linenoiseReadKey(l,&c,cbuf);
+    if (nread == LINENOISE_EDIT_MORE) return LINENOISE_EDIT_MORE;
+    if (nread <= 0) {
+        /* Re-show the original buffer when cycling through completions. */
+        if (l->cycle_index >= 0) completeLineShow(l, l->cycle_size);
+#ifndef _WIN32
+        /* The other end hung up: at an empty line, this is ctrl-d. */
+        if (nread == 0 && l->len == 0) {
+            historyPopBack();
+            return -1;
+        }
+#endif
+        return (int)l->len;
     }
+    l->idle_since = std::chrono::steady_clock::now();
+    if (c == UNKNOWN_KEY) return LINENOISE_EDIT_MORE;
 
-    return nread;
+    int action = linenoiseKeyAction(c);
+    if (l->menu_waiting) {
+        completeLineMenuKey(l, c, action);
+        return LINENOISE_EDIT_MORE;
+    }
+    if (l->cycle_index >= 0 && completeLineCycleKey(l, c, action)) return LINENOISE_EDIT_MORE;
+
+    switch(action) {
+    case ACTION_NONE:
+        break;
+    case ACTION_COMPLETE:
+        if (completionMenuCallback) {
+            completeLineMenu(l);
+            break;
+        }
+        /* Only autocomplete when the callback is set. Prefetched completions
+         * are shown at once, asynchronous ones when they arrive. */
+        if (completionCallback || completionRangeCallback || asyncCompletionCallback) {
+            if (linenoiseTakePrefetch(l) || linenoiseNarrowCompletions(l)) {
+                completeLineCycle(l);
+            } else {
+#ifndef _WIN32
+                if (asyncCompletionCallback) {
+                    linenoiseRequestCompletion(l);
+                    break;
+                }
+#endif
+                completeLine(l);
+            }
+            break;
+        }
+        if (c < UNKNOWN_KEY && linenoiseEditInsert(l,cbuf,nread)) return -1;
+        break;
+    case ACTION_ACCEPT_LINE:
+        return linenoiseEditAccept(l);
+    case ACTION_INTERRUPT:
+        linenoiseEditHideSuggestion(l);
+        errno = EAGAIN;
+        return -1;
+    case ACTION_BACKWARD_DELETE_CHAR:
+        linenoiseEditBackspace(l);
+        break;
+    case ACTION_DELETE_CHAR_OR_EOF:
+        /* Remove the char at the right of the cursor, or if the line is
+         * empty, act as end-of-file. */
+        if (l->len > 0) {
+            linenoiseEditDelete(l);
+        } else {
+            historyPopBack();
+            return -1;
+        }
+        break;
+    case ACTION_DELETE_CHAR:
+        linenoiseEditDelete(l);
+        break;
+    case ACTION_TRANSPOSE_CHARS: /* Swap the current character with the previous one. */
+        if (l->pos > 0 && l->pos < l->len) {
+            linenoiseEditChanged(l, l->pos-1, 2, 2);
+            char aux = buf[l->pos-1];
+            buf[l->pos-1] = buf[l->pos];
+            buf[l->pos] = aux;
+            if (l->pos != l->len-1) l->pos++;
+            refreshLine(l);
+        }
+        break;
+    case ACTION_BACKWARD_CHAR:
+        linenoiseEditMoveLeft(l);
+        break;
+    case ACTION_FORWARD_CHAR:
+        if (!linenoiseEditAcceptSuggestion(l)) linenoiseEditMoveRight(l);
+        break;
+    case ACTION_BACKWARD_WORD:
+        linenoiseEditMoveWordLeft(l);
+        break;
+    case ACTION_FORWARD_WORD:
+        linenoiseEditMoveWordRight(l);
+        break;
+    case ACTION_BEGINNING_OF_LINE:
+        linenoiseEditMoveHome(l);
+        break;
+    case ACTION_END_OF_LINE:
+        if (!linenoiseEditAcceptSuggestion(l)) linenoiseEditMoveEnd(l);
+        break;
+    case ACTION_PREVIOUS_HISTORY:
+        linenoiseEditHistoryNext(l, LINENOISE_HISTORY_PREV);
+        break;
+    case ACTION_NEXT_HISTORY:
+        linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
+        break;
+    case ACTION_KILL_WHOLE_LINE:
+        linenoiseEditChanged(l, 0, l->len, 0);
+        buf[0] = '\0';
+        l->pos = l->len = 0;
+        refreshLine(l);
+        break;
+    case ACTION_KILL_LINE: /* Delete from the cursor to the end of the line. */
+        linenoiseEditChanged(l, l->pos, l->len - l->pos, 0);
+        buf[l->pos] = '\0';
+        l->len = l->pos;
+        refreshLine(l);
+        break;
+    case ACTION_KILL_WORD:
+        linenoiseEditDeleteNextWord(l);
+        break;
+    case ACTION_UNIX_WORD_RUBOUT:
+        linenoiseEditDeletePrevWord(l);
+        break;
+    case ACTION_CLEAR_SCREEN:
+        linenoiseClearScreen(l);
+        refreshLine(l);
+        break;
+    case ACTION_SELF_INSERT:
+        if (c < UNKNOWN_KEY && linenoiseEditInsert(l,cbuf,nread)) return -1;
+        break;
+    default:
+        if (linenoiseEditUserAction(l, action)) return linenoiseEditAccept(l);
+        break;
+    }
+    return LINENOISE_EDIT_MORE;
 }
 
-/* Register a callback function to be called for tab-completion. */
-inline void SetCompletionCallback(CompletionCallback fn) {
-    completionCallback = fn;
+/* The action bound to 'key'. */
+inline int Editor::linenoiseKeyAction(int key) {
+    int i = linenoiseKeyIndex(key);
+    if (i >= 0) return keymap->actions[i];
+    return key < UNKNOWN_KEY ? ACTION_SELF_INSERT : ACTION_NONE;
 }
 
-/* =========================== Line editing ================================= */
+/* End editing with the line as it is. */
+inline int Editor::linenoiseEditAccept(struct linenoiseState *l) {
+    if (!history.empty()) historyPopBack();
+    if (mlmode) linenoiseEditMoveEnd(l);
+    linenoiseEditHideSuggestion(l);
+    return (int)l->len;
+}
 
-/* Single line low level line refresh.
+/* Run an application action on the line, applying what it changed.
+ * Returns true if it accepts the line. */
+inline bool Editor::linenoiseEditUserAction(struct linenoiseState *l, int action) {
+    size_t i = action - ACTION_USER;
+    if (i >= keymap->user.size()) return false;
+    /* A copy, as the action may change the bindings. */
+    KeyCallback fn = keymap->user[i].second;
+    std::string line(l->buf, l->len);
+    size_t pos = l->pos;
+    bool accept = fn(line, pos);
+    /* Replace only what changed, so highlighting stays incremental. */
+    size_t prefix = 0, suffix = 0;
+    size_t len = static_cast<size_t>(l->len);
+    while (prefix < len && prefix < line.size() && line[prefix] == l->buf[prefix]) prefix++;
+    while (suffix < len - prefix && suffix < line.size() - prefix &&
+           line[line.size() - 1 - suffix] == l->buf[len - 1 - suffix]) suffix++;
+    if (prefix != len || prefix != line.size()) {
+        linenoiseEditReplace(l, static_cast<int>(prefix), static_cast<int>(len - prefix - suffix),
+                             line.data() + prefix, static_cast<int>(line.size() - prefix - suffix));
+    }
+    l->pos = static_cast<int>(std::min(pos, static_cast<size_t>(l->len)));
+    refreshLine(l);
+    return accept;
+}
+
+/* This function is the core of the line editing capability of linenoise.
+ * It expects 'fd' to be already in "raw mode" so that every key pressed
+ * will be returned ASAP to read().
  *
- * Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-inline void refreshSingleLine(struct linenoiseState *l) {
-    char seq[64];
-    int pcolwid = unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()));
-    int fd = l->ofd;
-    char *buf = l->buf;
-    int len = l->len;
-    int pos = l->pos;
-    std::string ab;
+ * The resulting string is put into 'buf' when the user type enter, or
+ * when ctrl+d is typed.
+ *
+ * The function returns the length of the current buffer. */
+inline int Editor::linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, int buflen, const char *prompt)
+{
+    struct linenoiseState l;
 
-    while((pcolwid+unicodeColumnPos(buf, pos)) >= l->cols) {
-        int glen = unicodeGraphemeLen(buf, len, 0);
-        buf += glen;
-        len -= glen;
-        pos -= glen;
-    }
-    while (pcolwid+unicodeColumnPos(buf, len) > l->cols) {
-        len -= unicodePrevGraphemeLen(buf, len);
+    if (linenoiseEditStart(&l, stdin_fd, stdout_fd, buf, buflen, prompt) == -1) return -1;
+    while(1) {
+        if (!linenoiseWaitInput(&l)) return (int)l.len;
+        int ret = linenoiseEditFeed(&l);
+        if (ret != LINENOISE_EDIT_MORE) return ret;
     }
+}
 
-    /* Cursor to left edge */
-    snprintf(seq,64,"\r");
-    ab += seq;
-    /* Write the prompt and the current buffer content */
-    ab += l->prompt;
-    ab.append(buf, len);
-    /* Erase to right */
-    snprintf(seq,64,"\x1b[0K");
-    ab += seq;
-    /* Move cursor to original position. */
-    snprintf(seq,64,"\r\x1b[%dC", (int)(unicodeColumnPos(buf, pos)+pcolwid));
-    ab += seq;
-    if (write(fd,ab.c_str(), static_cast<int>(ab.length())) == -1) {} /* Can't recover from write error. */
+/* Read a line from the input when it is not a terminal, or one that can
+ * not be edited. Returns false at the end of the input. */
+inline bool Editor::linenoiseReadPlainLine(StringView& line) {
+    if (!line_reader) line_reader.reset(new LineReader(ifd));
+    return line_reader->Next(line);
 }
 
-/* Multi line low level line refresh.
- *
- * Rewrite the currently edited line accordingly to the buffer content,
- * cursor position, and number of columns of the terminal. */
-inline void refreshMultiLine(struct linenoiseState *l) {
-    char seq[64];
-    int pcolwid = unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()));
-    int colpos = unicodeColumnPosForMultiLine(l->buf, l->len, l->len, l->cols, pcolwid);
-    int colpos2; /* cursor column position. */
-    int rows = (pcolwid+colpos+l->cols-1)/l->cols; /* rows used by current buf. */
-    int rpos = (pcolwid+l->oldcolpos+l->cols)/l->cols; /* cursor relative row. */
-    int rpos2; /* rpos after refresh. */
-    int col; /* colum position, zero-based. */
-    int old_rows = (int)l->maxrows;
-    int fd = l->ofd, j;
-    std::string ab;
+/* This function calls the line editing function linenoiseEdit() using
+ * the input file descriptor of the editor set in raw mode. */
+inline bool Editor::linenoiseRaw(const char *prompt, StringView& line) {
+    bool quit = false;
 
-    /* Update maxrows if needed. */
-    if (rows > (int)l->maxrows) l->maxrows = rows;
+    /* Interactive editing. */
+    if (enableRawMode(ifd) == false) {
+        return quit;
+    }
 
-    /* First step: clear all the lines used before. To do so start by
-     * going to the last row. */
-    if (old_rows-rpos > 0) {
-        snprintf(seq,64,"\x1b[%dB", old_rows-rpos);
-        ab += seq;
+    if (!line_buf) line_buf.reset(new char[LINENOISE_MAX_LINE]);
+    auto count = linenoiseEdit(ifd, ofd, line_buf.get(), LINENOISE_MAX_LINE, prompt);
+    if (count == -1) {
+        quit = true;
+    } else {
+        line = StringView(line_buf.get(), count);
     }
 
-    /* Now for every row clear it, go up. */
-    for (j = 0; j < old_rows-1; j++) {
-        snprintf(seq,64,"\r\x1b[0K\x1b[1A");
-        ab += seq;
+    if (!raw_session_mode) disableRawMode(ifd);
+    if (linenoiseWrite(&output,"\n",1) == -1) {}
+    return quit;
+}
+
+/* The high level function that is the main API of the linenoise library.
+ * This function checks if the terminal has basic capabilities, just checking
+ * for a blacklist of stupid terminals, and later either edits the line or
+ * reads it as it is so that you will be able to type something even in the
+ * most desperate of the conditions. The line is not copied: 'line' points
+ * into the editor, and stays valid until its next Readline(). Returns true
+ * on ctrl-c, ctrl-d and at the end of the input, with 'line' empty. */
+inline bool Editor::Readline(const char *prompt, StringView& line) {
+    line = StringView();
+    if (plain_input || (!rawmode && !isatty(ifd))) {
+        /* Not a tty: read from file / pipe. */
+        plain_input = true;
+        return !linenoiseReadPlainLine(line);
+    } else if (isUnsupportedTerm()) {
+        if (ofd == STDOUT_FILENO) {
+            printf("%s",prompt);
+            fflush(stdout);
+        } else if (write(ofd,prompt,static_cast<int>(strlen(prompt))) == -1) {}
+        return !linenoiseReadPlainLine(line);
+    } else {
+        return linenoiseRaw(prompt, line);
     }
+}
 
-    /* Clean the top line. */
-    snprintf(seq,64,"\r\x1b[0K");
-    ab += seq;
+inline bool Readline(const char *prompt, StringView& line) {
+    return DefaultEditor().Readline(prompt, line);
+}
 
-    /* Write the prompt and the current buffer content */
-    ab += l->prompt;
-    ab.append(l->buf, l->len);
+inline bool Editor::Readline(const char *prompt, std::string& line) {
+    StringView view;
+    bool quit = Readline(prompt, view);
+    line.assign(view.data(), view.size());
+    return quit;
+}
 
-    /* Get text width to cursor position */
-    colpos2 = unicodeColumnPosForMultiLine(l->buf, l->len, l->pos, l->cols, pcolwid);
+inline bool Readline(const char *prompt, std::string& line) {
+    return DefaultEditor().Readline(prompt, line);
+}
 
-    /* If we are at the very end of the screen with our prompt, we need to
-     * emit a newline and move the prompt to the first column. */
-    if (l->pos &&
-        l->pos == l->len &&
-        (colpos2+pcolwid) % l->cols == 0)
-    {
-        ab += "\n";
-        snprintf(seq,64,"\r");
-        ab += seq;
-        rows++;
-        if (rows > (int)l->maxrows) l->maxrows = rows;
-    }
+inline std::string Editor::Readline(const char *prompt, bool& quit) {
+    std::string line;
+    quit = Readline(prompt, line);
+    return line;
+}
 
-    /* Move cursor to right position. */
-    rpos2 = (pcolwid+colpos2+l->cols)/l->cols; /* current cursor relative row. */
+inline std::string Readline(const char *prompt, bool& quit) {
+    return DefaultEditor().Readline(prompt, quit);
+}
 
-    /* Go up till we reach the expected positon. */
-    if (rows-rpos2 > 0) {
-        snprintf(seq,64,"\x1b[%dA", rows-rpos2);
-        ab += seq;
-    }
+inline std::string Editor::Readline(const char *prompt) {
+    bool quit; // dummy
+    return Readline(prompt, quit);
+}
 
-    /* Set column. */
-    col = (pcolwid + colpos2) % l->cols;
-    if (col)
-        snprintf(seq,64,"\r\x1b[%dC", col);
-    else
-        snprintf(seq,64,"\r");
-    ab += seq;
+inline std::string Readline(const char *prompt) {
+    return DefaultEditor().Readline(prompt);
+}
 
-    l->oldcolpos = colpos2;
+/* Read up to 'max_lines' lines of the input at once, without editing them,
+ * e.g. for scripts piped in: the views point into the buffered input and
+ * stay valid until the next call. Only the first line is waited for.
+ * Returns the number of lines, 0 at the end of the input. */
+inline size_t Editor::ReadLines(std::vector<StringView>& lines, size_t max_lines) {
+    if (!line_reader) line_reader.reset(new LineReader(ifd));
+    return line_reader->ReadLines(lines, max_lines);
+}
 
-    if (write(fd,ab.c_str(), static_cast<int>(ab.length())) == -1) {} /* Can't recover from write error. */
+inline size_t ReadLines(std::vector<StringView>& lines, size_t max_lines = LINENOISE_READ_LINES_MAX) {
+    return DefaultEditor().ReadLines(lines, max_lines);
 }
 
-/* Calls the two low level functions refreshSingleLine() or
- * refreshMultiLine() according to the selected mode. */
-inline void refreshLine(struct linenoiseState *l) {
-    if (mlmode)
-        refreshMultiLine(l);
-    else
-        refreshSingleLine(l);
+/* Stop editing started by EditStart(), putting the terminal back in its
+ * normal mode on a new line. */
+inline void Editor::EditStop() {
+    if (!edit_active) return;
+    if (!raw_session_mode) disableRawMode(edit_state.ifd);
+    if (linenoiseWrite(edit_state.output,"\n",1) == -1) {}
+    edit_active = false;
 }
 
-/* Insert the character 'c' at cursor current position.
- *
- * On error writing to the terminal -1 is returned, otherwise 0. */
-inline int linenoiseEditInsert(struct linenoiseState *l, const char* cbuf, int clen) {
-    if (l->len < l->buflen) {
-        if (l->len == l->pos) {
-            memcpy(&l->buf[l->pos],cbuf,clen);
-            l->pos+=clen;
-            l->len+=clen;;
-            l->buf[l->len] = '\0';
-            if ((!mlmode && unicodeColumnPos(l->prompt.c_str(), static_cast<int>(l->prompt.length()))+unicodeColumnPos(l->buf,l->len) < l->cols) /* || mlmode */) {
-                /* Avoid a full update of the line in the
-                 * trivial case. */
-                if (write(l->ofd,cbuf,clen) == -1) return -1;
-            } else {
-                refreshLine(l);
-            }
-        } else {
-            memmove(l->buf+l->pos+clen,l->buf+l->pos,l->len-l->pos);
-            memcpy(&l->buf[l->pos],cbuf,clen);
-            l->pos+=clen;
-            l->len+=clen;
-            l->buf[l->len] = '\0';
-            refreshLine(l);
-        }
-    }
-    return 0;
+inline void EditStop() {
+    DefaultEditor().EditStop();
 }
 
-/* Move cursor on the left. */
-inline void linenoiseEditMoveLeft(struct linenoiseState *l) {
-    if (l->pos > 0) {
-        l->pos -= unicodePrevGraphemeLen(l->buf, l->pos);
-        refreshLine(l);
+/* Start editing a line without blocking, for programs with their own event
+ * loop: show the prompt and put the terminal in raw mode. Then call
+ * EditFeed() when one of the descriptors from EditPollFds() is readable or
+ * after EditTimeout(), and EditStop() once it reports the end of the line.
+ * Returns false if the terminal is not interactive. Descriptors that are
+ * not a terminal, like sockets, are edited once SetTerminalSize() tells
+ * they lead to one, already in raw mode. */
+inline bool Editor::EditStart(const char *prompt) {
+    EditStop();
+    bool tty = rawmode || isatty(ifd);
+    if (tty ? isUnsupportedTerm() : term_cols <= 0) return false;
+    if (tty && !enableRawMode(ifd)) return false;
+    edit_active = true;
+    edit_done = false;
+    edit_hidden = false;
+    if (linenoiseEditStart(&edit_state, ifd, ofd, edit_buf, LINENOISE_MAX_LINE, prompt) == -1) {
+        EditStop();
+        return false;
     }
+    return true;
 }
 
-/* Move cursor on the right. */
-inline void linenoiseEditMoveRight(struct linenoiseState *l) {
-    if (l->pos != l->len) {
-        l->pos += unicodeGraphemeLen(l->buf, l->len, l->pos);
-        refreshLine(l);
+inline bool EditStart(const char *prompt) {
+    return DefaultEditor().EditStart(prompt);
+}
+
+/* Handle the keys typed and the background work done since the last call,
+ * without waiting for more. Returns EDIT_MORE until a line is entered,
+ * then EDIT_LINE with it in 'line', or EDIT_EOF. On Windows it waits for
+ * one key. */
+inline EditStatus Editor::EditFeed(std::string& line) {
+    if (!edit_active || edit_done) return EDIT_EOF;
+    while (1) {
+        int ret;
+#ifndef _WIN32
+        int n = linenoiseEditPoll(&edit_state, 0);
+        if (n == 0) {
+            if (linenoisePrefetchTimeout(&edit_state) == 0) linenoiseStartPrefetch(&edit_state);
+            return EDIT_MORE;
+        }
+        ret = n == 1 ? linenoiseEditFeed(&edit_state) : edit_state.len;
+        if (ret == LINENOISE_EDIT_MORE) continue;
+#else
+        ret = linenoiseEditFeed(&edit_state);
+        if (ret == LINENOISE_EDIT_MORE) return EDIT_MORE;
+#endif
+        edit_done = true;
+        if (ret < 0) return EDIT_EOF;
+        line.assign(edit_buf, ret);
+        return EDIT_LINE;
     }
 }
 
-/* Move cursor to the start of the line. */
-inline void linenoiseEditMoveHome(struct linenoiseState *l) {
-    if (l->pos != 0) {
-        l->pos = 0;
-        refreshLine(l);
+inline EditStatus EditFeed(std::string& line) {
+    return DefaultEditor().EditFeed(line);
+}
+
+/* The descriptors to wait on for EditFeed(): the terminal input and the
+ * ones background hints, completions and resizes wake up. They may change
+ * after each EditFeed(). */
+inline void Editor::EditPollFds(std::vector<int>& fds) {
+    fds.clear();
+    if (!edit_active) return;
+    fds.push_back(edit_state.ifd);
+    if (hints_worker.WakeFd() != -1) fds.push_back(hints_worker.WakeFd());
+    if (completion_worker.WakeFd() != -1) fds.push_back(completion_worker.WakeFd());
+    if (term_cols <= 0 && resize_watcher.Fd() != -1) fds.push_back(resize_watcher.Fd());
+}
+
+inline void EditPollFds(std::vector<int>& fds) {
+    DefaultEditor().EditPollFds(fds);
+}
+
+/* Milliseconds after which EditFeed() has work to do without input, or
+ * -1 if none. */
+inline int Editor::EditTimeout() {
+    if (!edit_active || edit_done) return -1;
+    int timeout = linenoisePrefetchTimeout(&edit_state);
+    int input_timeout = linenoiseInputTimeout();
+    if (input_timeout >= 0 && (timeout < 0 || input_timeout < timeout)) timeout = input_timeout;
+    return timeout;
+}
+
+inline int EditTimeout() {
+    return DefaultEditor().EditTimeout();
+}
+
+/* Erase the line being edited so the program can print something. Call
+ * EditShow() afterwards, before feeding more keys. */
+inline void Editor::EditHide() {
+    if (!edit_active || edit_hidden) return;
+    std::string ab;
+    if (mlmode) {
+        refreshClearRows(ab, &edit_state);
+        edit_state.maxrows = 0;
+        edit_state.oldcolpos = 0;
+    } else {
+        ab = "\r\x1b[0K";
     }
+    if (linenoiseWrite(edit_state.output,ab.c_str(),static_cast<int>(ab.length())) == -1) {}
+    edit_hidden = true;
+}
+
+inline void EditHide() {
+    DefaultEditor().EditHide();
+}
+
+/* Draw the line hidden by EditHide() again. */
+inline void Editor::EditShow() {
+    if (!edit_active || !edit_hidden) return;
+    edit_hidden = false;
+    refreshLine(&edit_state);
+}
+
+inline void EditShow() {
+    DefaultEditor().EditShow();
+}
+
+/* Write 'text' to the terminal output, e.g. between two lines or after
+ * EditHide(), behind the output queued before. Returns false on errors. */
+inline bool Editor::WriteOutput(StringView text) {
+    return linenoiseWrite(&output, text.data(), static_cast<int>(text.size())) != -1;
+}
+
+inline bool WriteOutput(StringView text) {
+    return DefaultEditor().WriteOutput(text);
+}
+
+/* A non-blocking terminal output takes what it can of each write; the rest
+ * is queued. Write more of it once the output is writable. Returns false on
+ * errors. */
+inline bool Editor::FlushOutput() {
+    return linenoiseFlush(&output) != -1;
+}
+
+inline bool FlushOutput() {
+    return DefaultEditor().FlushOutput();
+}
+
+/* Bytes of output queued, waiting for the terminal output to be writable. */
+inline size_t Editor::PendingOutput() const {
+    return output.queue.size();
 }
 
-/* Move cursor to the end of the line. */
-inline void linenoiseEditMoveEnd(struct linenoiseState *l) {
-    if (l->pos != l->len) {
-        l->pos = l->len;
-        refreshLine(l);
-    }
+inline size_t PendingOutput() {
+    return DefaultEditor().PendingOutput();
 }
 
-/* Substitute the currently edited line with the next or previous history
- * entry as specified by 'dir'. */
-#define LINENOISE_HISTORY_NEXT 0
-#define LINENOISE_HISTORY_PREV 1
-inline void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
-    if (history.size() > 1) {
-        /* Update the current history entry before to
-         * overwrite it with the next one. */
-        history[history.size() - 1 - l->history_index] = l->buf;
-        /* Show the new entry */
-        l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
-        if (l->history_index < 0) {
-            l->history_index = 0;
-            return;
-        } else if (l->history_index >= (int)history.size()) {
-            l->history_index = static_cast<int>(history.size())-1;
-            return;
-        }
-        memset(l->buf, 0, l->buflen);
-        strcpy(l->buf,history[history.size() - 1 - l->history_index].c_str());
-        l->len = l->pos = static_cast<int>(strlen(l->buf));
-        refreshLine(l);
-    }
+/* Use a terminal of 'cols' columns and 'rows' rows rather than asking it,
+ * e.g. for the size a remote client reported, redrawing the line being
+ * edited. Zero columns asks the terminal again. */
+inline void Editor::SetTerminalSize(int cols, int rows) {
+    term_cols = cols;
+    term_rows = rows;
+    if (edit_active && !edit_done) linenoiseEditResize(&edit_state);
 }
 
-/* Delete the character at the right of the cursor without altering the cursor
- * position. Basically this is what happens with the "Delete" keyboard key. */
-inline void linenoiseEditDelete(struct linenoiseState *l) {
-    if (l->len > 0 && l->pos < l->len) {
-        int glen = unicodeGraphemeLen(l->buf,l->len,l->pos);
-        memmove(l->buf+l->pos,l->buf+l->pos+glen,l->len-l->pos-glen);
-        l->len-=glen;
-        l->buf[l->len] = '\0';
-        refreshLine(l);
-    }
+inline void SetTerminalSize(int cols, int rows) {
+    DefaultEditor().SetTerminalSize(cols, rows);
 }
 
-/* Backspace implementation. */
-inline void linenoiseEditBackspace(struct linenoiseState *l) {
-    if (l->pos > 0 && l->len > 0) {
-        int glen = unicodePrevGraphemeLen(l->buf,l->pos);
-        memmove(l->buf+l->pos-glen,l->buf+l->pos,l->len-l->pos);
-        l->pos-=glen;
-        l->len-=glen;
-        l->buf[l->len] = '\0';
-        refreshLine(l);
-    }
+/* Wait this long for the rest of an escape sequence before taking its
+ * ESC as the Escape key. */
+inline void Editor::SetEscapeTimeout(int ms) {
+    escape_timeout_ms = ms;
 }
 
-/* Delete the previosu word, maintaining the cursor at the start of the
- * current word. */
-inline void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
-    int old_pos = l->pos;
-    int diff;
+inline void SetEscapeTimeout(int ms) {
+    DefaultEditor().SetEscapeTimeout(ms);
+}
 
-    while (l->pos > 0 && l->buf[l->pos-1] == ' ')
-        l->pos--;
-    while (l->pos > 0 && l->buf[l->pos-1] != ' ')
-        l->pos--;
-    diff = old_pos - l->pos;
-    memmove(l->buf+l->pos,l->buf+old_pos,l->len-old_pos+1);
-    l->len -= diff;
-    refreshLine(l);
+/* Ask the terminal, once, what it supports and where its cursor is, with
+ * all the queries in one write and at most 'timeout_ms' to answer them.
+ * The results are kept for later calls. The width is asked this way when
+ * ioctl() can not tell it. */
+inline const TerminalInfo& Editor::ProbeTerminal(int timeout_ms) {
+    if (terminal_probed) return terminal_info;
+    terminal_probed = true;
+#ifndef _WIN32
+    bool tty = isatty(ifd);
+    if (tty ? isUnsupportedTerm() : term_cols <= 0) return terminal_info;
+    bool raw = rawmode;
+    if (tty && !raw && !enableRawMode(ifd)) return terminal_info;
+    linenoiseProbeTerminal(timeout_ms);
+    if (tty && !raw) disableRawMode(ifd);
+#else
+    (void)timeout_ms;
+#endif
+    return terminal_info;
 }
 
-/* This function is the core of the line editing capability of linenoise.
- * It expects 'fd' to be already in "raw mode" so that every key pressed
- * will be returned ASAP to read().
- *
- * The resulting string is put into 'buf' when the user type enter, or
- * when ctrl+d is typed.
- *
- * The function returns the length of the current buffer. */
-inline int linenoiseEdit(int stdin_fd, int stdout_fd, char *buf, int buflen, const char *prompt)
-{
-    struct linenoiseState l;
+inline const TerminalInfo& ProbeTerminal(int timeout_ms = LINENOISE_DEFAULT_PROBE_TIMEOUT_MS) {
+    return DefaultEditor().ProbeTerminal(timeout_ms);
+}
 
-    /* Populate the linenoise state that we pass to functions implementing
-     * specific editing functionalities. */
-    l.ifd = stdin_fd;
-    l.ofd = stdout_fd;
-    l.buf = buf;
-    l.buflen = buflen;
-    l.prompt = prompt;
-    l.oldcolpos = l.pos = 0;
-    l.len = 0;
-    l.cols = getColumns(stdin_fd, stdout_fd);
-    l.maxrows = 0;
-    l.history_index = 0;
+/* Bind 'key', a code point or KEY_CODE with MOD_* bits, to 'action'.
+ * Returns false for keys that can not be bound: those outside ASCII. */
+inline bool Editor::BindKey(int key, EditAction action) {
+    int i = linenoiseKeyIndex(key);
+    if (i < 0) return false;
+    std::shared_ptr<Keymap> k = std::make_shared<Keymap>(*keymap);
+    k->actions[i] = static_cast<uint16_t>(action);
+    keymap = k;
+    return true;
+}
 
-    /* Buffer starts empty. */
-    l.buf[0] = '\0';
-    l.buflen--; /* Make sure there is always space for the nulterm */
+inline bool BindKey(int key, EditAction action) {
+    return DefaultEditor().BindKey(key, action);
+}
 
-    /* The latest history entry is always our current buffer, that
-     * initially is just an empty string. */
-    AddHistory("");
+/* Bind 'key' to an application action. */
+inline bool Editor::BindKey(int key, KeyCallback fn) {
+    if (linenoiseKeyIndex(key) < 0) return false;
+    return BindKey(key, static_cast<EditAction>(AddKeyAction("", fn)));
+}
 
-    if (write(l.ofd,prompt, static_cast<int>(l.prompt.length())) == -1) return -1;
-    while(1) {
-        int c;
-        char cbuf[4];
-        int nread;
-        char seq[3];
+inline bool BindKey(int key, KeyCallback fn) {
+    return DefaultEditor().BindKey(key, fn);
+}
 
-#ifdef _WIN32
-        nread = win32read(&c);
-        if (nread == 1) {
-            cbuf[0] = c;
-        }
-#else
-        nread = unicodeReadUTF8Char(l.ifd,cbuf,&c);
-#endif
-        if (nread <= 0) return (int)l.len;
-
-        /* Only autocomplete when the callback is set. It returns < 0 when
-         * there was an error reading from fd. Otherwise it will return the
-         * character that should be handled next. */
-        if (c == 9 && completionCallback != NULL) {
-            nread = completeLine(&l,cbuf,&c);
-            /* Return on errors */
-            if (c < 0) return l.len;
-            /* Read next character when 0 */
-            if (c == 0) continue;
-        }
-
-        switch(c) {
-        case ENTER:    /* enter */
-            if (!history.empty()) history.pop_back();
-            if (mlmode) linenoiseEditMoveEnd(&l);
-            return (int)l.len;
-        case CTRL_C:     /* ctrl-c */
-            errno = EAGAIN;
-            return -1;
-        case BACKSPACE:   /* backspace */
-        case 8:     /* ctrl-h */
-            linenoiseEditBackspace(&l);
-            break;
-        case CTRL_D:     /* ctrl-d, remove char at right of cursor, or if the
-                            line is empty, act as end-of-file. */
-            if (l.len > 0) {
-                linenoiseEditDelete(&l);
-            } else {
-                history.pop_back();
-                return -1;
-            }
-            break;
-        case CTRL_T:    /* ctrl-t, swaps current character with previous. */
-            if (l.pos > 0 && l.pos < l.len) {
-                char aux = buf[l.pos-1];
-                buf[l.pos-1] = buf[l.pos];
-                buf[l.pos] = aux;
-                if (l.pos != l.len-1) l.pos++;
-                refreshLine(&l);
-            }
-            break;
-        case CTRL_B:     /* ctrl-b */
-            linenoiseEditMoveLeft(&l);
-            break;
-        case CTRL_F:     /* ctrl-f */
-            linenoiseEditMoveRight(&l);
-            break;
-        case CTRL_P:    /* ctrl-p */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
-            break;
-        case CTRL_N:    /* ctrl-n */
-            linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
-            break;
-        case ESC:    /* escape sequence */
-            /* Read the next two bytes representing the escape sequence.
-             * Use two calls to handle slow terminals returning the two
-             * chars at different times. */
-            if (read(l.ifd,seq,1) == -1) break;
-            if (read(l.ifd,seq+1,1) == -1) break;
-
-            /* ESC [ sequences. */
-            if (seq[0] == '[') {
-                if (seq[1] >= '0' && seq[1] <= '9') {
-                    /* Extended escape, read additional byte. */
-                    if (read(l.ifd,seq+2,1) == -1) break;
-                    if (seq[2] == '~') {
-                        switch(seq[1]) {
-                        case '3': /* Delete key. */
-                            linenoiseEditDelete(&l);
-                            break;
-                        }
-                    }
-                } else {
-                    switch(seq[1]) {
-                    case 'A': /* Up */
-                        linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_PREV);
-                        break;
-                    case 'B': /* Down */
-                        linenoiseEditHistoryNext(&l, LINENOISE_HISTORY_NEXT);
-                        break;
-                    case 'C': /* Right */
-                        linenoiseEditMoveRight(&l);
-                        break;
-                    case 'D': /* Left */
-                        linenoiseEditMoveLeft(&l);
-                        break;
-                    case 'H': /* Home */
-                        linenoiseEditMoveHome(&l);
-                        break;
-                    case 'F': /* End*/
-                        linenoiseEditMoveEnd(&l);
-                        break;
-                    }
-                }
-            }
+/* Add an application action, that LoadKeymap() binds by 'name'. Returns
+ * its EditAction value. */
+inline int Editor::AddKeyAction(const char *name, KeyCallback fn) {
+    std::shared_ptr<Keymap> k = std::make_shared<Keymap>(*keymap);
+    k->user.push_back(std::make_pair(std::string(name), fn));
+    keymap = k;
+    return ACTION_USER + static_cast<int>(k->user.size()) - 1;
+}
 
-            /* ESC O sequences. */
-            else if (seq[0] == 'O') {
-                switch(seq[1]) {
-                case 'H': /* Home */
-                    linenoiseEditMoveHome(&l);
-                    break;
-                case 'F': /* End*/
-                    linenoiseEditMoveEnd(&l);
-                    break;
-                }
-            }
-            break;
-        default:
-            if (linenoiseEditInsert(&l,cbuf,nread)) return -1;
-            break;
-        case CTRL_U: /* Ctrl+u, delete the whole line. */
-            buf[0] = '\0';
-            l.pos = l.len = 0;
-            refreshLine(&l);
-            break;
-        case CTRL_K: /* Ctrl+k, delete from current to end of line. */
-            buf[l.pos] = '\0';
-            l.len = l.pos;
-            refreshLine(&l);
-            break;
-        case CTRL_A: /* Ctrl+a, go to the start of the line */
-            linenoiseEditMoveHome(&l);
-            break;
-        case CTRL_E: /* ctrl+e, go to the end of the line */
-            linenoiseEditMoveEnd(&l);
-            break;
-        case CTRL_L: /* ctrl+l, clear screen */
-            linenoiseClearScreen();
-            refreshLine(&l);
+inline int AddKeyAction(const char *name, KeyCallback fn) {
+    return DefaultEditor().AddKeyAction(name, fn);
+}
+
+/* Bind keys from 'config', one "key: action" per line, e.g.
+ *
+ *   C-b: backward-word
+ *   M-Left: beginning-of-line
+ *   F5: my-action    # added with AddKeyAction()
+ *
+ * Blank lines and text after '#' are ignored. Returns false at the first
+ * line that is not understood, keeping the bindings of the lines before. */
+inline bool Editor::LoadKeymap(const char *config) {
+    std::shared_ptr<Keymap> k = std::make_shared<Keymap>(*keymap);
+    std::string text(config);
+    bool ok = true;
+    size_t from = 0;
+    while (from < text.size()) {
+        size_t eol = std::min(text.find('\n', from), text.size());
+        std::string line = text.substr(from, eol - from);
+        from = eol + 1;
+        /* A '#' key is written "#:" or "M-#:". */
+        size_t hash = line.find('#');
+        if (hash != std::string::npos && line.compare(hash, 2, "#:") != 0) line.erase(hash);
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos) continue;
+        line = line.substr(first, line.find_last_not_of(" \t\r") + 1 - first);
+        size_t colon = line.find(':', 1);
+        if (colon == std::string::npos) {
+            ok = false;
             break;
-        case CTRL_W: /* ctrl+w, delete previous word */
-            linenoiseEditDeletePrevWord(&l);
+        }
+        std::string name = line.substr(colon + 1);
+        name.erase(0, name.find_first_not_of(" \t"));
+        int i = linenoiseKeyIndex(linenoiseParseKey(StringView(line.data(), colon)));
+        int action = -1;
+        for (int a = 0; a < ACTION_USER; a++) {
+            if (name == linenoiseActionNames[a]) action = a;
+        }
+        for (size_t a = 0; a < k->user.size(); a++) {
+            if (!name.empty() && name == k->user[a].first) action = ACTION_USER + static_cast<int>(a);
+        }
+        if (i < 0 || action < 0) {
+            ok = false;
             break;
         }
+        k->actions[i] = static_cast<uint16_t>(action);
     }
-    return l.len;
+    keymap = k;
+    return ok;
 }
 
-/* This function calls the line editing function linenoiseEdit() using
- * the STDIN file descriptor set in raw mode. */
-inline bool linenoiseRaw(const char *prompt, std::string& line) {
-    bool quit = false;
+inline bool LoadKeymap(const char *config) {
+    return DefaultEditor().LoadKeymap(config);
+}
 
-    if (!isatty(STDIN_FILENO)) {
-        /* Not a tty: read from file / pipe. */
-        std::getline(std::cin, line);
-    } else {
-        /* Interactive editing. */
-        if (enableRawMode(STDIN_FILENO) == false) {
-            return quit;
-        }
+/* Go back to the default emacs bindings, forgetting application actions. */
+inline void Editor::ResetKeymap() {
+    keymap = DefaultKeymap();
+}
 
-        char buf[LINENOISE_MAX_LINE];
-        auto count = linenoiseEdit(STDIN_FILENO, STDOUT_FILENO, buf, LINENOISE_MAX_LINE, prompt);
-        if (count == -1) {
-            quit = true;
-        } else {
-            line.assign(buf, count);
-        }
+inline void ResetKeymap() {
+    DefaultEditor().ResetKeymap();
+}
+
+#ifdef LINENOISE_COROUTINES
+
+/* Awaitable returned by AsyncReadline(). */
+class ReadlineAwaiter {
+public:
+    ReadlineAwaiter(Editor& e, const char *p, InputWaiter w)
+        : editor(e), prompt(p), waiter(std::move(w)) {}
 
-        disableRawMode(STDIN_FILENO);
-        printf("\n");
+    /* Not interactive: the line is read at once, as Readline() does. */
+    bool await_ready() {
+        if (editor.EditStart(prompt)) return false;
+        if (!editor.Readline(prompt, line)) result = std::move(line);
+        return true;
     }
-    return quit;
-}
 
-/* The high level function that is the main API of the linenoise library.
- * This function checks if the terminal has basic capabilities, just checking
- * for a blacklist of stupid terminals, and later either calls the line
- * editing function or uses dummy fgets() so that you will be able to type
- * something even in the most desperate of the conditions. */
-inline bool Readline(const char *prompt, std::string& line) {
-    if (isUnsupportedTerm()) {
-        printf("%s",prompt);
-        fflush(stdout);
-        std::getline(std::cin, line);
-        return false;
-    } else {
-        return linenoiseRaw(prompt, line);
+    void await_suspend(std::coroutine_handle<> h) {
+        handle = h;
+        wait();
     }
-}
 
-inline std::string Readline(const char *prompt, bool& quit) {
+    /* The line entered, or nothing on ctrl-c, ctrl-d and errors. */
+    std::optional<std::string> await_resume() { return std::move(result); }
+
+private:
+    void wait() {
+        std::vector<int> fds;
+        editor.EditPollFds(fds);
+        waiter(fds, editor.EditTimeout(), [this]() { feed(); });
+    }
+
+    void feed() {
+        EditStatus status = editor.EditFeed(line);
+        if (status == EDIT_MORE) {
+            wait();
+            return;
+        }
+        editor.EditStop();
+        if (status == EDIT_LINE) result = std::move(line);
+        handle.resume();
+    }
+
+    Editor& editor;
+    const char *prompt;
+    InputWaiter waiter;
     std::string line;
-    quit = Readline(prompt, line);
-    return line;
+    std::optional<std::string> result;
+    std::coroutine_handle<> handle;
+};
+
+/* Read a line in a C++20 coroutine: co_await AsyncReadline(prompt, waiter)
+ * suspends while there is no input and handles the keys as 'waiter'
+ * resumes it, so no thread is parked in read(). It uses the session of
+ * EditStart(), so one line is read at a time. */
+inline ReadlineAwaiter Editor::AsyncReadline(const char *prompt, InputWaiter waiter) {
+    return ReadlineAwaiter(*this, prompt, std::move(waiter));
 }
 
-inline std::string Readline(const char *prompt) {
-    bool quit; // dummy
-    return Readline(prompt, quit);
+inline ReadlineAwaiter AsyncReadline(const char *prompt, InputWaiter waiter) {
+    return DefaultEditor().AsyncReadline(prompt, waiter);
 }
 
+#endif /* LINENOISE_COROUTINES */
+
 /* ================================ History ================================= */
 
-/* At exit we'll try to fix the terminal to the initial conditions. */
+/* At exit we'll try to fix the terminals to the initial conditions: those
+ * of the editors still in raw mode, which may already be destroyed. */
 inline void linenoiseAtExit(void) {
-    disableRawMode(STDIN_FILENO);
+#ifndef _WIN32
+    linenoiseSetRawTerminals(true);
+#else
+    if (consolemodeIn) {
+        SetConsoleMode(hIn, consolemodeIn);
+        consolemodeIn = 0;
+    }
+#endif
 }
 
 /* This is the API call to add a new entry in the linenoise history.
@@ -2345,37 +6253,77 @@ inline void linenoiseAtExit(void) {
  * histories, but will work well for a few hundred of entries.
  *
  * Using a circular buffer is smarter, but a bit more complex to handle. */
-inline bool AddHistory(const char* line) {
+inline bool Editor::AddHistory(const char* line) {
     if (history_max_len == 0) return false;
 
     /* Don't add duplicated lines. */
     if (!history.empty() && history.back() == line) return false;
 
     /* If we reached the max length, remove the older line. */
-    if (history.size() == history_max_len) {
-        history.erase(history.begin());
-    }
+    if (history.size() == history_max_len) historyPopFront();
     history.push_back(line);
+    history_index.insert(history_base + history.size() - 1);
 
     return true;
 }
 
+inline bool AddHistory(const char* line) {
+    return DefaultEditor().AddHistory(line);
+}
+
+/* Replace the history entry 'i' keeping the prefix index in sync: the
+ * index orders entries by their line, so it must not change while in it. */
+inline void Editor::historyReplace(size_t i, const char *line) {
+    history_index.erase(history_base + i);
+    history[i] = line;
+    history_index.insert(history_base + i);
+}
+
+/* Remove the newest history entry keeping the prefix index in sync. */
+inline void Editor::historyPopBack(void) {
+    history_index.erase(history_base + history.size() - 1);
+    history.pop_back();
+}
+
+/* Remove the oldest history entry keeping the prefix index in sync. */
+inline void Editor::historyPopFront(void) {
+    history_index.erase(history_base);
+    history.erase(history.begin());
+    history_base++;
+}
+
+/* The line of the history entry numbered 'seq', or 'history_probe'. */
+inline StringView Editor::historyLine(unsigned long seq) const {
+    if (seq == ULONG_MAX) return history_probe;
+    return StringView(history[seq - history_base]);
+}
+
+/* The first entry of the prefix index whose line is not below 'prefix'. */
+inline Editor::HistoryIndex::const_iterator Editor::historyLowerBound(StringView prefix) {
+    history_probe = prefix;
+    auto it = history_index.lower_bound(ULONG_MAX);
+    history_probe = StringView();
+    return it;
+}
+
 /* Set the maximum length for the history. This function can be called even
  * if there is already some history, the function will make sure to retain
  * just the latest 'len' elements if the new history length value is smaller
  * than the amount of items already inside the history. */
-inline bool SetHistoryMaxLen(size_t len) {
+inline bool Editor::SetHistoryMaxLen(size_t len) {
     if (len < 1) return false;
     history_max_len = len;
-    if (len < history.size()) {
-        history.resize(len);
-    }
+    while (len < history.size()) historyPopFront();
     return true;
 }
 
+inline bool SetHistoryMaxLen(size_t len) {
+    return DefaultEditor().SetHistoryMaxLen(len);
+}
+
 /* Save the history in the specified file. On success *true* is returned
  * otherwise *false* is returned. */
-inline bool SaveHistory(const char* path) {
+inline bool Editor::SaveHistory(const char* path) {
     std::ofstream f(path); // TODO: need 'std::ios::binary'?
     if (!f) return false;
     for (const auto& h: history) {
@@ -2384,12 +6332,16 @@ inline bool SaveHistory(const char* path) {
     return true;
 }
 
+inline bool SaveHistory(const char* path) {
+    return DefaultEditor().SaveHistory(path);
+}
+
 /* Load the history from the specified file. If the file does not exist
  * zero is returned and no operation is performed.
  *
  * If the file exists and the operation succeeded *true* is returned, otherwise
  * on error *false* is returned. */
-inline bool LoadHistory(const char* path) {
+inline bool Editor::LoadHistory(const char* path) {
     std::ifstream f(path);
     if (!f) return false;
     std::string line;
@@ -2399,10 +6351,272 @@ inline bool LoadHistory(const char* path) {
     return true;
 }
 
-inline const std::vector<std::string>& GetHistory() {
+inline bool LoadHistory(const char* path) {
+    return DefaultEditor().LoadHistory(path);
+}
+
+inline const std::vector<std::string>& Editor::GetHistory() {
     return history;
 }
 
+inline const std::vector<std::string>& GetHistory() {
+    return DefaultEditor().GetHistory();
+}
+
+#ifdef __linux__
+
+/* ============================ Session server ============================== */
+
+/* Called with each line entered in 'session'. Its prompt is shown again
+ * once this returns, unless the session was closed meanwhile. */
+typedef std::function<void (int session, const std::string& line)> SessionLineCallback;
+
+/* Called once 'session' ended on ctrl-c, ctrl-d, the end of its input or
+ * an error. It is already removed; its descriptors are left open. */
+typedef std::function<void (int session)> SessionCloseCallback;
+
+/* Edits lines for many terminals on one thread, from an epoll loop. Each
+ * session is an Editor with its own descriptors, size, history and
+ * callbacks, fed as its input arrives, so the cost of a key does not
+ * depend on the number of sessions. Descriptors that are not terminals are
+ * made non-blocking: the output a client does not read is queued and
+ * written once it can take more, so it never stalls the other sessions,
+ * and a client that lets LINENOISE_SESSION_MAX_OUTPUT bytes pile up is
+ * closed. Sockets are written with MSG_NOSIGNAL, so a client that went away
+ * ends its session rather than raising SIGPIPE. */
+class SessionServer {
+public:
+    SessionServer() : epfd(epoll_create1(EPOLL_CLOEXEC)), live(0), serial(0), running(false) {}
+
+    ~SessionServer() {
+        sessions.clear();
+        if (epfd != -1) close(epfd);
+    }
+
+    SessionServer(const SessionServer&) = delete;
+    SessionServer& operator=(const SessionServer&) = delete;
+
+    void SetLineCallback(SessionLineCallback fn) {
+        lineCallback = fn;
+    }
+
+    void SetCloseCallback(SessionCloseCallback fn) {
+        closeCallback = fn;
+    }
+
+    /* Start editing a line on 'ifd' and 'ofd' with 'prompt'. A terminal of
+     * this process is put in raw mode; other descriptors, like sockets,
+     * must lead to a terminal of 'cols' columns and 'rows' rows already in
+     * raw mode. Returns the id of the session, or -1. */
+    int Add(int ifd, int ofd, const char *prompt, int cols = 0, int rows = 0) {
+        int id;
+        if (free_ids.empty()) {
+            id = static_cast<int>(sessions.size());
+            sessions.emplace_back();
+        } else {
+            id = free_ids.back();
+            free_ids.pop_back();
+        }
+        sessions[id].reset(new Session(ifd, ofd, prompt, ++serial));
+        Editor& editor = sessions[id]->editor;
+        for (int fd: {ifd, ofd}) {
+            int flags = fcntl(fd, F_GETFL);
+            if (!isatty(fd) && flags != -1) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+        if (cols > 0) editor.SetTerminalSize(cols, rows);
+        if (epfd == -1 || !editor.EditStart(prompt)) {
+            sessions[id].reset();
+            free_ids.push_back(id);
+            return -1;
+        }
+        live++;
+        watch(id);
+        return id;
+    }
+
+    /* The editor of 'session', to set its callbacks, modes and history. */
+    Editor& GetEditor(int session) {
+        return sessions[session]->editor;
+    }
+
+    /* Show 'prompt' from the next line of 'session' on. */
+    void SetPrompt(int session, const char *prompt) {
+        sessions[session]->prompt = prompt;
+    }
+
+    /* Write 'text' to the terminal of 'session', e.g. from the line
+     * callback, behind the output still queued. */
+    void Write(int session, StringView text) {
+        sessions[session]->editor.WriteOutput(text);
+        watch(session);
+    }
+
+    /* The terminal of 'session' is now 'cols' columns by 'rows' rows. */
+    void Resize(int session, int cols, int rows) {
+        sessions[session]->editor.SetTerminalSize(cols, rows);
+    }
+
+    /* End 'session' without calling the close callback. */
+    void Close(int session) {
+        if (!exists(session)) return;
+        Session& s = *sessions[session];
+        for (const auto& w: s.fds) epoll_ctl(epfd, EPOLL_CTL_DEL, w.first, NULL);
+        timed.erase(session);
+        sessions[session].reset();
+        free_ids.push_back(session);
+        live--;
+    }
+
+    /* Number of sessions. */
+    size_t Size() const {
+        return live;
+    }
+
+    /* Readable when Poll() has input to handle, to nest the server in
+     * another event loop. */
+    int Fd() const {
+        return epfd;
+    }
+
+    /* Milliseconds after which a session has work to do without input, or
+     * -1 if none. */
+    int Timeout() {
+        int timeout = -1;
+        for (int id: timed) {
+            int t = sessions[id]->editor.EditTimeout();
+            if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+        }
+        return timeout;
+    }
+
+    /* Wait at most 'timeout_ms' (-1 for no limit) for input and handle it.
+     * Returns the number of events handled, or -1 on error. */
+    int Poll(int timeout_ms) {
+        int t = Timeout();
+        if (t >= 0 && (timeout_ms < 0 || t < timeout_ms)) timeout_ms = t;
+        struct epoll_event events[LINENOISE_SESSION_EVENTS];
+        int n = epoll_wait(epfd, events, LINENOISE_SESSION_EVENTS, timeout_ms);
+        if (n == -1) return errno == EINTR ? 0 : -1;
+        /* An event queued for a session closed by an earlier one of this
+         * batch must not reach a new session given the same id. */
+        for (int i = 0; i < n; i++) {
+            feed(static_cast<int>(events[i].data.u64 & 0xFFFFFFFF),
+                 static_cast<uint32_t>(events[i].data.u64 >> 32));
+        }
+        if (!timed.empty()) {
+            std::vector<int> due(timed.begin(), timed.end());
+            for (int id: due) {
+                if (exists(id) && sessions[id]->editor.EditTimeout() == 0) {
+                    feed(id, static_cast<uint32_t>(sessions[id]->serial));
+                }
+            }
+        }
+        return n;
+    }
+
+    /* Poll() until Stop() is called, from a callback, or an error. */
+    void Run() {
+        running = true;
+        while (running && Poll(-1) != -1) {}
+    }
+
+    void Stop() {
+        running = false;
+    }
+
+private:
+    struct Session {
+        Session(int ifd, int session_ofd, const char *session_prompt, unsigned long session_serial)
+            : editor(ifd, session_ofd), prompt(session_prompt), serial(session_serial), ofd(session_ofd) {}
+        Editor editor;
+        std::string prompt;
+        unsigned long serial;  /* Tells a session from a later one with its id. */
+        int ofd;
+        std::vector<std::pair<int, uint32_t>> fds; /* Registered with epfd, and their events. */
+    };
+
+    bool exists(int id) const {
+        return id >= 0 && id < static_cast<int>(sessions.size()) && sessions[id];
+    }
+
+    /* Register the descriptors 'id' now waits on, its output while some is
+     * queued, and whether it has work to do without input. */
+    void watch(int id) {
+        Session& s = *sessions[id];
+        std::vector<int> in;
+        s.editor.EditPollFds(in);
+        std::vector<std::pair<int, uint32_t>> fds;
+        for (int fd: in) fds.push_back(std::make_pair(fd, static_cast<uint32_t>(EPOLLIN)));
+        if (s.editor.PendingOutput()) {
+            auto out = std::find_if(fds.begin(), fds.end(),
+                                    [&](const std::pair<int, uint32_t>& w) { return w.first == s.ofd; });
+            if (out != fds.end()) out->second |= EPOLLOUT;
+            else fds.push_back(std::make_pair(s.ofd, static_cast<uint32_t>(EPOLLOUT)));
+        }
+        for (const auto& w: fds) {
+            auto old = std::find_if(s.fds.begin(), s.fds.end(),
+                                    [&](const std::pair<int, uint32_t>& o) { return o.first == w.first; });
+            if (old != s.fds.end() && old->second == w.second) continue;
+            struct epoll_event ev;
+            ev.events = w.second;
+            ev.data.u64 = static_cast<uint64_t>(static_cast<uint32_t>(s.serial)) << 32 |
+                          static_cast<uint32_t>(id);
+            epoll_ctl(epfd, old != s.fds.end() ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, w.first, &ev);
+        }
+        for (const auto& o: s.fds) {
+            auto now = std::find_if(fds.begin(), fds.end(),
+                                    [&](const std::pair<int, uint32_t>& w) { return w.first == o.first; });
+            if (now == fds.end()) epoll_ctl(epfd, EPOLL_CTL_DEL, o.first, NULL);
+        }
+        s.fds.swap(fds);
+        if (s.editor.EditTimeout() >= 0) {
+            timed.insert(id);
+        } else {
+            timed.erase(id);
+        }
+    }
+
+    /* Write the queued output of 'id' and handle its input, reporting the
+     * line it completes, unless 'id' now belongs to a session later than
+     * the one with 'event_serial'. */
+    void feed(int id, uint32_t event_serial) {
+        if (!exists(id) || static_cast<uint32_t>(sessions[id]->serial) != event_serial) return;
+        Session& s = *sessions[id];
+        std::string line;
+        EditStatus status = EDIT_EOF;
+        if (s.editor.FlushOutput()) status = s.editor.EditFeed(line);
+        if (s.editor.PendingOutput() > LINENOISE_SESSION_MAX_OUTPUT) status = EDIT_EOF;
+        if (status == EDIT_MORE) {
+            watch(id);
+            return;
+        }
+        s.editor.EditStop();
+        if (status == EDIT_LINE) {
+            unsigned long current = s.serial;
+            if (lineCallback) lineCallback(id, line);
+            if (!exists(id) || sessions[id]->serial != current) return;
+            if (s.editor.EditStart(s.prompt.c_str())) {
+                watch(id);
+                return;
+            }
+        }
+        Close(id);
+        if (closeCallback) closeCallback(id);
+    }
+
+    std::vector<std::unique_ptr<Session>> sessions; /* Indexed by id. */
+    std::vector<int> free_ids;
+    std::set<int> timed;  /* Sessions with an EditTimeout(). */
+    int epfd;
+    size_t live;
+    unsigned long serial;
+    bool running;
+    SessionLineCallback lineCallback;
+    SessionCloseCallback closeCallback;
+};
+
+#endif /* __linux__ */
+
 } // namespace linenoise
 
 #ifdef _WIN32